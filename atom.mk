@@ -10,9 +10,13 @@ LOCAL_CFLAGS := -DH265_API_EXPORTS -fvisibility=hidden -std=gnu99 -D_GNU_SOURCE
 LOCAL_SRC_FILES := \
 	src/h265.c \
 	src/h265_bitstream.c \
+	src/h265_cpb.c \
 	src/h265_ctx.c \
+	src/h265_dpb.c \
 	src/h265_dump.c \
 	src/h265_reader.c \
+	src/h265_rtp.c \
+	src/h265_scan.c \
 	src/h265_types.c \
 	src/h265_writer.c
 
@@ -38,3 +42,15 @@ LOCAL_LIBRARIES := \
 	libh265 \
 	libulog
 include $(BUILD_EXECUTABLE)
+
+include $(CLEAR_VARS)
+LOCAL_MODULE := h265-rtp-replay
+LOCAL_DESCRIPTION := H.265 RTP depacketizer replay tool
+LOCAL_CATEGORY_PATH := libs/h265
+LOCAL_CFLAGS := -std=gnu99
+LOCAL_SRC_FILES := \
+	tools/h265_rtp_replay.c
+LOCAL_LIBRARIES := \
+	libh265 \
+	libulog
+include $(BUILD_EXECUTABLE)
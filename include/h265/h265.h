@@ -32,6 +32,16 @@
 #include <stdlib.h>
 #include <string.h>
 
+#ifdef _WIN32
+/* Same as struct iovec of <sys/uio.h> */
+struct iovec {
+	void *iov_base;
+	size_t iov_len;
+};
+#else /* !_WIN32 */
+#	include <sys/uio.h>
+#endif /* !_WIN32 */
+
 #ifdef __cplusplus
 extern "C" {
 #endif /* __cplusplus */
@@ -53,10 +63,14 @@ extern "C" {
 
 #include "h265/h265_ctx.h"
 
+#include "h265/h265_cpb.h"
+
 #include "h265/h265_dump.h"
 #include "h265/h265_reader.h"
 #include "h265/h265_writer.h"
 
+#include "h265/h265_rtp.h"
+
 
 H265_API int h265_get_info(const uint8_t *vps,
 			   size_t vps_len,
@@ -72,13 +86,107 @@ H265_API int h265_sar_to_aspect_ratio_idc(unsigned int sar_width,
 
 
 /* Note: this function expects start code length to be 4 bytes;
- * 3 bytes start codes are not supported */
+ * 3 bytes start codes are not supported, see h265_byte_stream_to_hvcc_copy()
+ * for an out-of-place conversion without this restriction */
 H265_API int h265_byte_stream_to_hvcc(uint8_t *data, size_t len);
 
 
+/**
+ * Convert a byte stream buffer to NAL units preceded by their size as a
+ * big-endian integer (hvcC / MP4 sample format), out of place. Both 3 and 4
+ * bytes start codes are supported; the leading and trailing zero bytes
+ * (leading_zero_8bits and trailing_zero_8bits) are removed. The output size
+ * can be queried first by passing a NULL output buffer.
+ *
+ * @param buf,len Byte stream buffer
+ * @param length_size Size in bytes of the NAL unit lengths: 1, 2 or 4
+ * @param out Output buffer, or NULL to only compute the output length
+ * @param out_size Size of the output buffer
+ * @param out_len Length of the converted data (written or needed)
+ *
+ * @return 0 on success, -ENOBUFS if the output buffer is too small, -EPROTO
+ * if a NAL unit is too large for the length size, negative errno value in
+ * case of error
+ */
+H265_API int h265_byte_stream_to_hvcc_copy(const uint8_t *buf,
+					   size_t len,
+					   uint32_t length_size,
+					   uint8_t *out,
+					   size_t out_size,
+					   size_t *out_len);
+
+
+/**
+ * Same as h265_byte_stream_to_hvcc_copy(), the output being written in
+ * sequence to the buffers of an iovec list.
+ *
+ * @param buf,len Byte stream buffer
+ * @param length_size Size in bytes of the NAL unit lengths: 1, 2 or 4
+ * @param iov,iov_count Output buffers, or NULL to only compute the output
+ * length
+ * @param out_len Length of the converted data (written or needed)
+ *
+ * @return 0 on success, -ENOBUFS if the output buffers are too small,
+ * -EPROTO if a NAL unit is too large for the length size, negative errno
+ * value in case of error
+ */
+H265_API int h265_byte_stream_to_hvcc_iov(const uint8_t *buf,
+					  size_t len,
+					  uint32_t length_size,
+					  const struct iovec *iov,
+					  size_t iov_count,
+					  size_t *out_len);
+
+
 H265_API int h265_hvcc_to_byte_stream(uint8_t *data, size_t len);
 
 
+/**
+ * Parse an HEVC decoder configuration record (hvcC box payload, see ISO/IEC
+ * 14496-15 8.3.3.1). The VPS, SPS and PPS of the record are parsed and set
+ * in the context, along with their raw bytes (see
+ * h265_ctx_is_ps_unchanged()); the NAL units of other types are ignored.
+ *
+ * @param buf,len Record to parse
+ * @param ctx Context receiving the parameter sets
+ * @param hvcc Optional record fields (output), or NULL
+ *
+ * @return 0 on success, -EPROTO if the record is invalid, negative errno
+ * value in case of error
+ */
+H265_API int h265_hvcc_parse(const uint8_t *buf,
+			     size_t len,
+			     struct h265_ctx *ctx,
+			     struct h265_hvcc *hvcc);
+
+
+/**
+ * Build an HEVC decoder configuration record (hvcC box payload, see ISO/IEC
+ * 14496-15 8.3.3.1) from all the VPS, SPS and PPS of a context, in
+ * increasing id order. The profile, tier and level, chroma format, bit
+ * depths, number of temporal layers and min_spatial_segmentation_idc are
+ * those of the SPS with the lowest id. A parameter set is written with its
+ * raw bytes if it was parsed, otherwise it is serialized. The record size
+ * can be queried first by passing a NULL output buffer.
+ *
+ * @param ctx Context holding the parameter sets
+ * @param length_size Size in bytes of the NAL unit lengths of the samples:
+ * 1, 2 or 4
+ * @param buf Output buffer, or NULL to only compute the record size
+ * @param size Size of the output buffer
+ * @param len Size of the record (written or needed)
+ *
+ * @return 0 on success, -ENOBUFS if the output buffer is too small, -ENOENT
+ * if the context has no VPS, SPS or PPS, negative errno value in case of
+ * error
+ */
+H265_API int h265_hvcc_build(struct h265_ctx *ctx,
+			     uint32_t length_size,
+			     uint8_t *buf,
+			     size_t size,
+			     size_t *len);
+
+
 #ifdef __cplusplus
 }
 #endif /* __cplusplus */
@@ -28,6 +28,11 @@
 #define _H265_BITSTREAM_H_
 
 
+/* Number of readable bytes that shall follow the data of a padded bitstream,
+ * see h265_bs_cinit_padded(); the contents of these bytes do not matter */
+#define H265_BS_PADDING 8
+
+
 struct h265_bitstream {
 	union {
 		/* Data pointer (const) */
@@ -43,8 +48,12 @@ struct h265_bitstream {
 	/* Offset in data */
 	size_t off;
 
-	/* Partial read/write byte */
-	uint8_t cache;
+	/* Partial read/write bits; when reading, up to 64 bits are cached and
+	 * the unread ones are the 'cachebits' least significant bits; when
+	 * writing, the pending bits are the 'cachebits' least significant
+	 * bits (less than 32 between calls, and none when the stream is
+	 * byte-aligned) */
+	uint64_t cache;
 
 	/* Number of bits in cache */
 	uint8_t cachebits;
@@ -55,6 +64,21 @@ struct h265_bitstream {
 	/* Dynamic */
 	int dynamic;
 
+	/* Reading: offset in data of the byte holding the rbsp_stop_one_bit
+	 * (equal to len if there is none), and number of zero bits following
+	 * it in this byte; only valid if stop_found is set (they are computed
+	 * on the first h265_bs_more_rbsp_data() call) */
+	size_t stop_off;
+	uint8_t stop_zeros;
+	int stop_found;
+
+	/* Reading: H265_BS_PADDING readable bytes follow the data */
+	int padded;
+
+	/* Reading: an unchecked read went past the end of the stream, see
+	 * h265_bs_overread() */
+	int overread;
+
 	/* Private data */
 	void *priv;
 };
@@ -79,6 +103,99 @@ H265_API
 int h265_find_nalu(const uint8_t *buf, size_t len, size_t *start, size_t *end);
 
 
+/* NAL unit location in a bytestream buffer */
+struct h265_nalu_span {
+	/* Offset of the first byte of the NAL unit (after the start code) */
+	size_t off;
+
+	/* Length of the NAL unit (up to the next start code or trailing
+	 * zero bytes, or the end of the buffer) */
+	size_t len;
+
+	/* Length of the start code preceding the NAL unit (3 or 4 bytes) */
+	uint32_t start_code_len;
+
+	/* NAL unit type, H265_NALU_TYPE_UNKNOWN if the NAL unit is empty */
+	enum h265_nalu_type type;
+};
+
+
+/**
+ * Get the location of all the NAL units in buf.
+ *
+ * This function indexes the whole buffer in a single pass; the NAL units
+ * found are the same as with successive calls to h265_find_nalu(). The last
+ * NAL unit extends to the end of the buffer.
+ *
+ * @param[in] buf,len Bytestream buffer
+ * @param[out] spans Array receiving the NAL unit locations
+ * @param[in] max Number of elements of the spans array; NAL units past this
+ * count are not stored but still counted
+ * @param[out] count Total number of NAL units found in buf
+ *
+ * @return 0 on success, negative errno value in case of error
+ */
+H265_API
+int h265_find_nalus(const uint8_t *buf,
+		    size_t len,
+		    struct h265_nalu_span *spans,
+		    size_t max,
+		    size_t *count);
+
+
+/**
+ * Convert a NAL unit to its RBSP by removing emulation prevention bytes.
+ *
+ * See 7.3.1.1 General NAL unit syntax and 7.4.2 NAL unit semantics: every
+ * emulation_prevention_three_byte (0x03 following two 0x00 bytes) is removed.
+ * The output buffer can be the same as the input buffer for an in-place
+ * conversion.
+ *
+ * @param[in] nalu,nalu_len NAL unit buffer (starting with the NAL unit header)
+ * @param[out] rbsp Output buffer, at least nalu_len bytes long
+ * @param[out] rbsp_len Length of the RBSP written in rbsp
+ * @param[out] ep_pos Optional array receiving the offsets in nalu of the
+ * removed bytes, or NULL
+ * @param[in] ep_max Number of elements of the ep_pos array; positions past
+ * this count are not stored
+ * @param[out] ep_count Optional total number of removed bytes, or NULL
+ *
+ * @return 0 on success, negative errno value in case of error
+ */
+H265_API
+int h265_nalu_to_rbsp(const uint8_t *nalu,
+		      size_t nalu_len,
+		      uint8_t *rbsp,
+		      size_t *rbsp_len,
+		      size_t *ep_pos,
+		      size_t ep_max,
+		      size_t *ep_count);
+
+
+/**
+ * Convert an RBSP to a NAL unit by inserting emulation prevention bytes.
+ *
+ * See 7.4.2 NAL unit semantics: an emulation_prevention_three_byte is
+ * inserted after every two consecutive 0x00 bytes followed by a byte lower
+ * than or equal to 0x03, and after a final 0x00 byte. The output size can
+ * be queried first by passing a NULL output buffer.
+ *
+ * @param[in] rbsp,rbsp_len RBSP buffer (starting with the NAL unit header)
+ * @param[out] nalu Output buffer, or NULL to only compute the output length
+ * @param[in] nalu_size Size of the output buffer
+ * @param[out] nalu_len Length of the NAL unit (written or needed)
+ *
+ * @return 0 on success, -ENOBUFS if the output buffer is too small,
+ * negative errno value in case of error
+ */
+H265_API
+int h265_rbsp_to_nalu(const uint8_t *rbsp,
+		      size_t rbsp_len,
+		      uint8_t *nalu,
+		      size_t nalu_size,
+		      size_t *nalu_len);
+
+
 /**
  * Write bits to the stream.
  *
@@ -138,6 +255,41 @@ int h265_bs_write_raw_bytes(struct h265_bitstream *bs,
 			    size_t len);
 
 
+/**
+ * Read bytes from the stream.
+ *
+ * The stream does not need to be byte-aligned; when it is, the bytes are
+ * copied in bulk (emulation prevention bytes being skipped if enabled).
+ *
+ * @param bs Bitstream handle
+ * @param buf Output buffer, at least len bytes long
+ * @param len Number of bytes to read
+ *
+ * @return 0 on success, -EIO if end of stream is reached, negative errno value
+ * in case of error
+ */
+H265_API
+int h265_bs_read_bytes(struct h265_bitstream *bs, uint8_t *buf, size_t len);
+
+
+/**
+ * Write bytes to the stream.
+ *
+ * The stream does not need to be byte-aligned; when it is, the bytes are
+ * copied in bulk (emulation prevention bytes being inserted if enabled).
+ *
+ * @param bs Bitstream handle
+ * @param buf Bytes to write
+ * @param len Number of bytes to write
+ *
+ * @return 0 on success, negative errno value in case of error
+ */
+H265_API
+int h265_bs_write_bytes(struct h265_bitstream *bs,
+			const uint8_t *buf,
+			size_t len);
+
+
 /**
  * Take ownership of a bitstream's buffer.
  *
@@ -166,6 +318,28 @@ static inline void h265_bs_cinit(struct h265_bitstream *bs,
 }
 
 
+/**
+ * Initialize a bitstream for reading data followed by at least
+ * H265_BS_PADDING readable bytes (e.g. a buffer allocated with this extra
+ * size). The padding lets the read cache be refilled with whole word loads
+ * up to the end of the data; the padding bytes are never returned.
+ *
+ * @param[in] bs Uninitialized bitstream
+ * @param[in] buf Pointer to an array of at least len + H265_BS_PADDING bytes
+ * @param[in] len Length of the data in buf
+ * @param[in] emulation_prevention Whether to skip emulation prevention
+ * bytes
+ */
+static inline void h265_bs_cinit_padded(struct h265_bitstream *bs,
+					const uint8_t *buf,
+					size_t len,
+					int emulation_prevention)
+{
+	h265_bs_cinit(bs, buf, len, emulation_prevention);
+	bs->padded = 1;
+}
+
+
 /**
  * Initialize a bitstream.
  *
@@ -239,9 +413,39 @@ static inline size_t h265_bs_rem_raw_bits(const struct h265_bitstream *bs)
 
 
 /**
- * Fetch a byte from the stream and cache its bits.
+ * Get the offset in data of the next unread byte.
+ *
+ * The stream is expected to be byte-aligned. Bytes that have been fetched in
+ * the read cache but not consumed yet are accounted for, as well as the
+ * escape bytes skipped by emulation prevention among them.
+ *
+ * @param bs Bitstream instance handle
+ *
+ * @return Offset of the next unread byte
+ */
+static inline size_t h265_bs_read_off(const struct h265_bitstream *bs)
+{
+	size_t off = bs->off;
+	uint32_t n = bs->cachebits / 8;
+
+	/* Escape bytes are only skipped one byte at a time, see
+	 * h265_bs_fetch() */
+	while (n > 0) {
+		off--;
+		if (!bs->emulation_prevention || off < 2 ||
+		    bs->cdata[off] != 0x03 || bs->cdata[off - 1] != 0x00 ||
+		    bs->cdata[off - 2] != 0x00)
+			n--;
+	}
+	return off;
+}
+
+
+/**
+ * Fetch a byte from the stream and append its bits to the cache.
  *
  * This function takes emulation prevention into account and skips escape bytes.
+ * The cache shall have room for at least 8 more bits.
  *
  * @param bs Bitstream instance handle
  *
@@ -251,18 +455,18 @@ static inline int h265_bs_fetch(struct h265_bitstream *bs)
 {
 	/* Detect 0x00 0x00 0x03 sequence in the stream */
 	if (bs->emulation_prevention && bs->off >= 2 &&
-	    bs->cdata[bs->off - 2] == 0x00 && bs->cdata[bs->off - 1] == 0x00 &&
-	    bs->cdata[bs->off] == 0x03) {
+	    bs->off < bs->len && bs->cdata[bs->off - 2] == 0x00 &&
+	    bs->cdata[bs->off - 1] == 0x00 && bs->cdata[bs->off] == 0x03) {
 		if (bs->off + 1 >= bs->len)
 			return -EIO;
 		/* Skip escape byte */
-		bs->cache = bs->cdata[bs->off + 1];
-		bs->cachebits = 8;
+		bs->cache = (bs->cache << 8) | bs->cdata[bs->off + 1];
+		bs->cachebits += 8;
 		bs->off += 2;
 		return 0;
 	} else if (bs->off < bs->len) {
-		bs->cache = bs->cdata[bs->off];
-		bs->cachebits = 8;
+		bs->cache = (bs->cache << 8) | bs->cdata[bs->off];
+		bs->cachebits += 8;
 		bs->off++;
 		return 0;
 	} else {
@@ -272,6 +476,77 @@ static inline int h265_bs_fetch(struct h265_bitstream *bs)
 }
 
 
+/**
+ * Load 8 bytes from an unaligned address as a big-endian 64-bit word.
+ */
+static inline uint64_t h265_bs_load_be64(const uint8_t *p)
+{
+#if defined(__GNUC__) && defined(__BYTE_ORDER__)
+	uint64_t v;
+	memcpy(&v, p, sizeof(v));
+#	if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	v = __builtin_bswap64(v);
+#	endif
+	return v;
+#else
+	return ((uint64_t)p[0] << 56) | ((uint64_t)p[1] << 48) |
+	       ((uint64_t)p[2] << 40) | ((uint64_t)p[3] << 32) |
+	       ((uint64_t)p[4] << 24) | ((uint64_t)p[5] << 16) |
+	       ((uint64_t)p[6] << 8) | (uint64_t)p[7];
+#endif
+}
+
+
+/**
+ * Refill the read cache so that it holds at least n bits.
+ *
+ * When at least 8 bytes are left in the stream (or any byte is left in a
+ * padded stream) and none of them can be an emulation prevention byte (no
+ * 0x03 byte), the cache is topped up with a single word load; otherwise bytes
+ * are fetched one at a time.
+ *
+ * @param bs Bitstream instance handle
+ * @param n Number of bits wanted in the cache (at most 32)
+ *
+ * @return 0 on success, -EIO if end of stream is reached
+ */
+static inline int h265_bs_refill(struct h265_bitstream *bs, uint32_t n)
+{
+	uint64_t w = 0;
+	uint32_t count = 0;
+	size_t avail = bs->len - bs->off;
+
+	if (avail >= 8 || (bs->padded && avail > 0)) {
+		/* The bytes past the end of a padded stream are loaded but
+		 * not used */
+		w = h265_bs_load_be64(bs->cdata + bs->off);
+		/* Look for a 0x03 byte in the word (SWAR zero byte test) */
+		uint64_t x = w ^ UINT64_C(0x0303030303030303);
+		int has_03 = ((x - UINT64_C(0x0101010101010101)) & ~x &
+			      UINT64_C(0x8080808080808080)) != 0;
+		if (!bs->emulation_prevention || !has_03) {
+			count = (64 - bs->cachebits) / 8;
+			if (count > avail)
+				count = avail;
+			if (count == 8)
+				bs->cache = w;
+			else
+				bs->cache = (bs->cache << (count * 8)) |
+					    (w >> (64 - count * 8));
+			bs->cachebits += count * 8;
+			bs->off += count;
+			return bs->cachebits >= n ? 0 : -EIO;
+		}
+	}
+
+	/* Fetch as many bytes as possible, one at a time */
+	while (bs->cachebits <= 56 && h265_bs_fetch(bs) == 0)
+		;
+
+	return bs->cachebits >= n ? 0 : -EIO;
+}
+
+
 /**
  * 7.2 Read n bits from the stream.
  *
@@ -290,29 +565,99 @@ h265_bs_read_bits(struct h265_bitstream *bs, uint32_t *v, uint32_t n)
 {
 	int res = 0;
 	uint32_t bits = 0;
-	uint32_t mask = 0;
-	uint32_t part = 0;
+	uint64_t val = 0;
 
 	*v = 0;
 	while (n > 0) {
-		/* Fetch data if needed */
-		if (bs->cachebits == 0 && h265_bs_fetch(bs) < 0)
+		/* Fill the cache if needed */
+		bits = n < 32 ? n : 32;
+		if (bs->cachebits < bits && h265_bs_refill(bs, bits) < 0)
 			return -EIO;
 
-		/* Read as many bits from cache */
-		bits = n < bs->cachebits ? n : bs->cachebits;
-		mask = (1 << bits) - 1;
-		part = (bs->cache >> (bs->cachebits - bits)) & mask;
-		*v = (*v << bits) | part;
+		/* Extract bits from cache */
+		val = (val << bits) |
+		      ((bs->cache >> (bs->cachebits - bits)) &
+		       ((UINT64_C(1) << bits) - 1));
 		n -= bits;
 		bs->cachebits -= bits;
 		res += bits;
 	}
 
+	*v = (uint32_t)val;
 	return res;
 }
 
 
+/**
+ * Query whether an unchecked read went past the end of the stream.
+ *
+ * Unchecked reads (h265_bs_read_bits_unchecked() and the like) never fail:
+ * the bits past the end of the stream are read as zeros and this condition
+ * is recorded, so that a whole structure can be parsed without checking
+ * each field and then checked once.
+ *
+ * @param bs Bitstream instance handle
+ *
+ * @return 1 if an unchecked read went past the end of the stream, 0 otherwise
+ */
+static inline int h265_bs_overread(const struct h265_bitstream *bs)
+{
+	return bs->overread;
+}
+
+
+/**
+ * 7.2 Read n bits from the stream without error checking, see
+ * h265_bs_overread().
+ *
+ * On a padded stream without emulation prevention bytes (see
+ * h265_bs_cinit_padded()), the cache is topped up with a single word load
+ * which may cover the padding: there is no escape byte scan and no byte by
+ * byte fallback, the number of bytes taken is only clamped to the end of the
+ * data.
+ *
+ * @return The bits read, 0 if the end of stream is reached
+ */
+static inline uint32_t h265_bs_read_bits_unchecked(struct h265_bitstream *bs,
+						   uint32_t n)
+{
+	uint32_t v = 0;
+	uint32_t count = 0;
+	uint64_t w = 0;
+
+	if (!bs->padded || bs->emulation_prevention || n == 0 || n > 32) {
+		if (h265_bs_read_bits(bs, &v, n) < 0)
+			bs->overread = 1;
+		return v;
+	}
+
+	if (bs->cachebits < n) {
+		/* off <= len always holds, so the load stays within the
+		 * padding; 4 to 8 bytes fit in the cache (cachebits < 32),
+		 * but fewer may remain in the data: count is 0 to 8 */
+		w = h265_bs_load_be64(bs->cdata + bs->off);
+		count = (64 - bs->cachebits) / 8;
+		if (count > bs->len - bs->off)
+			count = bs->len - bs->off;
+		/* Split shifts: a 64-bit shift by count * 8 would be undefined
+		 * for count 8 (cache) and count 0 (w) */
+		bs->cache = (bs->cache << (count * 4) << (count * 4)) |
+			    (w >> (32 - count * 4) >> (32 - count * 4));
+		bs->cachebits += count * 8;
+		bs->off += count;
+		if (bs->cachebits < n) {
+			bs->overread = 1;
+			return 0;
+		}
+	}
+
+	v = (uint32_t)((bs->cache >> (bs->cachebits - n)) &
+		       ((UINT64_C(1) << n) - 1));
+	bs->cachebits -= n;
+	return v;
+}
+
+
 /**
  * 7.2 Read an unsigned integer using n bits.
  */
@@ -369,13 +714,60 @@ static inline int h265_bs_read_bits_se(struct h265_bitstream *bs, int32_t *v)
 
 	res = h265_bs_read_bits_ue(bs, &u32);
 	if (res >= 0) {
-		*v = (u32 & 1) ? (((int32_t)u32 + 1) / 2)
-			       : (-((int32_t)u32 + 1) / 2);
+		/* Table 9-3: odd codes are positive, even codes negative */
+		*v = (u32 & 1) ? (int32_t)((u32 >> 1) + 1)
+			       : -(int32_t)(u32 >> 1);
 	}
 	return res;
 }
 
 
+static inline uint32_t
+h265_bs_read_bits_u_unchecked(struct h265_bitstream *bs, uint32_t n)
+{
+	return h265_bs_read_bits_unchecked(bs, n);
+}
+
+
+static inline int32_t
+h265_bs_read_bits_i_unchecked(struct h265_bitstream *bs, uint32_t n)
+{
+	uint32_t u32 = h265_bs_read_bits_unchecked(bs, n);
+
+	/* Sign extend result */
+	if ((u32 & (1 << (n - 1))) != 0)
+		return (int32_t)(u32 | ((uint32_t)-1) << n);
+	else
+		return (int32_t)u32;
+}
+
+
+static inline uint32_t
+h265_bs_read_bits_ue_unchecked(struct h265_bitstream *bs)
+{
+	uint32_t v = 0;
+
+	if (h265_bs_read_bits_ue(bs, &v) < 0) {
+		bs->overread = 1;
+		v = 0;
+	}
+	return v;
+}
+
+
+static inline int32_t
+h265_bs_read_bits_se_unchecked(struct h265_bitstream *bs)
+{
+	int32_t v = 0;
+
+	if (h265_bs_read_bits_se(bs, &v) < 0) {
+		bs->overread = 1;
+		v = 0;
+	}
+	return v;
+}
+
+
 /**
  * 9.1 Parsing process for Exp-Golomb codes.
  */
@@ -0,0 +1,195 @@
+/**
+ * Copyright (c) 2019 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Drones SAS Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT DRONES SAS COMPANY BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _H265_CPB_H_
+#define _H265_CPB_H_
+
+
+/**
+ * Coded picture buffer model (Annex C), at the access unit level: the access
+ * units enter the CPB at the CPB bit rate and are removed instantaneously at
+ * their removal time. All times are in microseconds; the arrival times are
+ * relative to the arrival of the first bit of the first access unit.
+ */
+struct h265_cpb;
+
+
+/* E.3.3 CPB parameters of a schedule */
+struct h265_cpb_params {
+	/* BitRate in bits per second */
+	uint64_t bit_rate;
+
+	/* CpbSize in bits */
+	uint64_t cpb_size;
+
+	/* 1: constant bit rate (the access units arrive without gap);
+	 * 0: variable bit rate */
+	int cbr_flag;
+
+	/* Removal time of the first access unit, i.e. initial CPB removal
+	 * delay (initial_cpb_removal_delay / 90000 s of the buffering period
+	 * SEI) */
+	uint64_t initial_removal_delay;
+};
+
+
+/* Access unit given to the CPB model */
+struct h265_cpb_au {
+	/* Size in bytes */
+	size_t size;
+
+	/* Earliest arrival time of the first bit (e.g. reception time);
+	 * only used with a variable bit rate */
+	uint64_t arrival_time;
+
+	/* Nominal removal time relative to the removal of the first access
+	 * unit (e.g. au_cpb_removal_delay_minus1 + 1 clock ticks after the
+	 * preceding buffering period of the picture timing SEI, or decoding
+	 * order number times picture duration) */
+	uint64_t removal_time;
+};
+
+
+/* Removal of an access unit from the CPB */
+struct h265_cpb_removal {
+	/* Decoding order number of the access unit */
+	uint64_t index;
+
+	/* Initial arrival time (first bit) */
+	uint64_t initial_arrival_time;
+
+	/* Final arrival time (last bit) */
+	uint64_t final_arrival_time;
+
+	/* Removal time (initial removal delay + nominal removal time) */
+	uint64_t removal_time;
+
+	/* CPB fullness in bits just before the removal */
+	uint64_t fullness;
+
+	/* 1: underflow, the access unit is not complete at its removal time
+	 * (final arrival time after removal time); 0 otherwise */
+	int underflow;
+
+	/* 1: overflow, the fullness is greater than CpbSize; 0 otherwise */
+	int overflow;
+};
+
+
+/* CPB model statistics */
+struct h265_cpb_stats {
+	/* Number of access units added */
+	uint64_t au_count;
+
+	/* Number of access units removed */
+	uint64_t removed_count;
+
+	/* Maximum CPB fullness in bits */
+	uint64_t max_fullness;
+
+	/* Number of removals with an underflow */
+	uint64_t underflow_count;
+
+	/* Number of access units during the arrival of which the CPB
+	 * overflows (checked at the removals and final arrivals) */
+	uint64_t overflow_count;
+
+	/* Minimum initial removal delay without underflow for the access
+	 * units added so far */
+	uint64_t min_initial_removal_delay;
+};
+
+
+struct h265_cpb_cbs {
+	/* Called for each access unit removal, in decoding order */
+	void (*removal)(struct h265_cpb *cpb,
+			const struct h265_cpb_removal *removal,
+			void *userdata);
+};
+
+
+/**
+ * Get the CPB parameters of a schedule from HRD parameters (E.3.3); the
+ * initial_removal_delay field is set to 0.
+ *
+ * @param hrd HRD parameters (VPS or VUI)
+ * @param sub_layer Index of the sub-layer (HighestTid)
+ * @param vcl 1 for the VCL HRD parameters, 0 for the NAL HRD parameters
+ * @param sched_sel_idx Index of the schedule (SchedSelIdx)
+ * @param params CPB parameters (output)
+ *
+ * @return 0 on success, -ENOENT if the HRD parameters are not present,
+ * negative errno value in case of error
+ */
+H265_API
+int h265_cpb_params_from_hrd(const struct h265_hrd *hrd,
+			     uint32_t sub_layer,
+			     int vcl,
+			     uint32_t sched_sel_idx,
+			     struct h265_cpb_params *params);
+
+
+H265_API
+int h265_cpb_new(const struct h265_cpb_params *params,
+		 const struct h265_cpb_cbs *cbs,
+		 void *userdata,
+		 struct h265_cpb **ret_obj);
+
+
+H265_API
+int h265_cpb_destroy(struct h265_cpb *cpb);
+
+
+/**
+ * Add the next access unit in decoding order. The removals occurring up to
+ * the final arrival of the access unit are processed.
+ *
+ * @param cpb CPB model handle
+ * @param au Access unit
+ *
+ * @return 0 on success, negative errno value in case of error
+ */
+H265_API
+int h265_cpb_add_au(struct h265_cpb *cpb, const struct h265_cpb_au *au);
+
+
+/**
+ * Process the removal of all the access units still in the CPB, at the end
+ * of the stream.
+ *
+ * @param cpb CPB model handle
+ *
+ * @return 0 on success, negative errno value in case of error
+ */
+H265_API
+int h265_cpb_flush(struct h265_cpb *cpb);
+
+
+H265_API
+int h265_cpb_get_stats(struct h265_cpb *cpb, struct h265_cpb_stats *stats);
+
+
+#endif /* !_H265_CPB_H_ */
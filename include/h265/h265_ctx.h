@@ -31,6 +31,53 @@
 struct h265_ctx;
 
 
+/**
+ * Parameter set changes, see the ps_changed callback
+ */
+
+/* No parameter set with the same id was known */
+#define H265_PS_CHANGED_NEW (1 << 0)
+
+/* Profile, tier or level */
+#define H265_PS_CHANGED_PROFILE (1 << 1)
+
+/* Picture size (pic_width_in_luma_samples, pic_height_in_luma_samples) */
+#define H265_PS_CHANGED_RESOLUTION (1 << 2)
+
+/* Conformance cropping window */
+#define H265_PS_CHANGED_CROP (1 << 3)
+
+/* Luma or chroma bit depth */
+#define H265_PS_CHANGED_BIT_DEPTH (1 << 4)
+
+/* Chroma format (chroma_format_idc, separate_colour_plane_flag) */
+#define H265_PS_CHANGED_CHROMA_FORMAT (1 << 5)
+
+/* Number of sub-layers or DPB size, reordering and latency */
+#define H265_PS_CHANGED_DPB (1 << 6)
+
+/* Timing information (VPS or VUI) */
+#define H265_PS_CHANGED_TIMING (1 << 7)
+
+/* Video signal type and colour description (VUI) */
+#define H265_PS_CHANGED_COLOUR (1 << 8)
+
+/* Sample aspect ratio (VUI) */
+#define H265_PS_CHANGED_SAR (1 << 9)
+
+/* HRD parameters (VPS or VUI) */
+#define H265_PS_CHANGED_HRD (1 << 10)
+
+/* Tiles layout */
+#define H265_PS_CHANGED_TILES (1 << 11)
+
+/* Wavefront parallel processing (entropy_coding_sync_enabled_flag) */
+#define H265_PS_CHANGED_WPP (1 << 12)
+
+/* Any other syntax element */
+#define H265_PS_CHANGED_OTHER (1 << 13)
+
+
 struct h265_ctx_cbs {
 	void (*nalu_begin)(struct h265_ctx *ctx,
 			   enum h265_nalu_type type,
@@ -46,6 +93,8 @@ struct h265_ctx_cbs {
 			 const struct h265_nalu_header *nh,
 			 void *userdata);
 
+	/* Called at the end of each access unit; the info of its picture can
+	 * then be retrieved with h265_ctx_get_au_info() */
 	void (*au_end)(struct h265_ctx *ctx, void *userdata);
 
 	void (*vps)(struct h265_ctx *ctx,
@@ -110,6 +159,38 @@ struct h265_ctx_cbs {
 		size_t len,
 		const struct h265_sei_content_light_level *sei,
 		void *userdata);
+
+	/* Called after the vps, sps or pps callback when the parameter set
+	 * differs from the stored one with the same id (see the
+	 * H265_PS_CHANGED_* bits); a repeated identical parameter set never
+	 * triggers this callback. The info is computed from the current VPS,
+	 * SPS and PPS, and is NULL if they are not all known yet */
+	void (*ps_changed)(struct h265_ctx *ctx,
+			   enum h265_nalu_type type,
+			   uint32_t changes,
+			   const struct h265_info *info,
+			   void *userdata);
+
+	/* Called for each slice segment of the base layer (nuh_layer_id
+	 * equal to 0) whose PPS and SPS are known; slice_data_offset is the
+	 * offset in buf of the first byte of slice_data(), following the
+	 * byte_alignment() at the end of the slice segment header */
+	void (*slice_header)(struct h265_ctx *ctx,
+			     const uint8_t *buf,
+			     size_t len,
+			     const struct h265_slice_header *sh,
+			     size_t slice_data_offset,
+			     void *userdata);
+
+	/* Called for each picture output by the output order DPB model of
+	 * C.5.2 ("bumping" process), driven by sps_max_num_reorder_pics,
+	 * sps_max_latency_increase_plus1 and sps_max_dec_pic_buffering_minus1
+	 * of the highest sub-layer; the pictures whose slice segment header
+	 * is not parsed are not part of the model. The pictures left in the
+	 * DPB at the end of the stream are output by h265_ctx_dpb_flush() */
+	void (*dpb_output)(struct h265_ctx *ctx,
+			   const struct h265_dpb_output *output,
+			   void *userdata);
 };
 
 
@@ -129,6 +210,20 @@ H265_API
 int h265_ctx_is_nalu_unknown(struct h265_ctx *ctx);
 
 
+/**
+ * Whether the parameter set of the current NAL unit is byte-identical to the
+ * stored one it replaces; in that case it has not been parsed again and the
+ * vps, sps or pps callback is given the stored structure.
+ *
+ * @param ctx Context handle
+ *
+ * @return 1 if the current NAL unit is an unchanged parameter set, 0
+ * otherwise
+ */
+H265_API
+int h265_ctx_is_ps_unchanged(struct h265_ctx *ctx);
+
+
 H265_API int h265_ctx_set_nalu_header(struct h265_ctx *ctx,
 				      const struct h265_nalu_header *nh);
 
@@ -149,6 +244,58 @@ H265_API
 int h265_ctx_set_pps(struct h265_ctx *ctx, const struct h265_pps *pps);
 
 
+/**
+ * Set the slice segment header to write. The PPS it refers to and the SPS
+ * of this PPS shall be set first; only the slice segment header and its
+ * byte_alignment() are written by h265_write_nalu(), the slice data shall
+ * then be appended by the caller. The entry points are copied.
+ *
+ * @param ctx Context handle
+ * @param sh Slice segment header
+ *
+ * @return 0 on success, negative errno value in case of error
+ */
+H265_API
+int h265_ctx_set_slice_header(struct h265_ctx *ctx,
+			      const struct h265_slice_header *sh);
+
+
+H265_API
+const struct h265_slice_header *
+h265_ctx_get_slice_header(struct h265_ctx *ctx);
+
+
+/**
+ * Get the info of the current access unit (base layer picture), including
+ * its picture order count. When called from the au_end callback, it is the
+ * info of the access unit that just ended.
+ *
+ * @param ctx Context handle
+ * @param info Access unit info (output)
+ *
+ * @return 0 on success, negative errno value in case of error
+ */
+H265_API
+int h265_ctx_get_au_info(struct h265_ctx *ctx, struct h265_au_info *info);
+
+
+/**
+ * Output all the pictures of the DPB model waiting for output and empty it,
+ * e.g. at the end of the stream (see the dpb_output callback). This is also
+ * done on end of sequence and end of bitstream NAL units, and by
+ * h265_reader_flush().
+ *
+ * @param ctx Context handle
+ * @param cbs,userdata Callbacks the pictures are output to
+ *
+ * @return 0 on success, negative errno value in case of error
+ */
+H265_API
+int h265_ctx_dpb_flush(struct h265_ctx *ctx,
+		       const struct h265_ctx_cbs *cbs,
+		       void *userdata);
+
+
 H265_API
 const struct h265_vps *h265_ctx_get_vps(struct h265_ctx *ctx);
 
@@ -31,6 +31,59 @@
 struct h265_reader;
 
 
+/**
+ * Reader flags
+ */
+
+/* Streaming mode: the buffers given to h265_reader_parse() are consecutive
+ * chunks of a bytestream and may end in the middle of a NAL unit. The last
+ * NAL unit of a buffer is only parsed once its end is found in a following
+ * buffer, or by h265_reader_flush(). The incomplete NAL unit is copied in an
+ * internal buffer and the returned offset is the end of the buffer */
+#define H265_READER_FLAGS_STREAM (1 << 0)
+
+/* Streaming mode without copy (with H265_READER_FLAGS_STREAM): the returned
+ * offset is the start of the incomplete data (start code and NAL unit, or
+ * trailing zero bytes). The caller keeps this data alive and gives it again
+ * at the beginning of the next buffer, followed by the new data; scanning
+ * resumes where it stopped */
+#define H265_READER_FLAGS_STREAM_NO_COPY (1 << 1)
+
+/* Do not parse the VUI of SPS; the SPS is stored as if it had no VUI and the
+ * syntax following it (SPS extensions) is not parsed either */
+#define H265_READER_FLAGS_SKIP_VUI (1 << 2)
+
+/* Do not parse the HRD parameters of VPS and VUI; they are stored as absent
+ * and the syntax following them (end of the VUI and SPS extensions, VPS
+ * extension) is not parsed either */
+#define H265_READER_FLAGS_SKIP_HRD (1 << 3)
+
+/* Do not decode SEI payloads; SEI messages are still split and given to the
+ * sei callback as raw payloads */
+#define H265_READER_FLAGS_SKIP_SEI_PAYLOAD (1 << 4)
+
+/* Only parse the NAL unit headers: only the nalu_begin, nalu_end and au_end
+ * callbacks are called */
+#define H265_READER_FLAGS_NALU_ONLY (1 << 5)
+
+/* Only parse the parameter sets (VPS, SPS and PPS); other NAL units are
+ * handled as with H265_READER_FLAGS_NALU_ONLY */
+#define H265_READER_FLAGS_PS_ONLY (1 << 6)
+
+/* SEI payloads without emulation prevention bytes are not copied: the raw
+ * payloads given to the sei callbacks (and the user data of unregistered user
+ * data SEI) point directly in the NAL unit buffer given by the caller, and are
+ * only valid as long as this buffer */
+#define H265_READER_FLAGS_SEI_NO_COPY (1 << 7)
+
+/* The buffers given to h265_reader_parse() and h265_reader_parse_nalu() are
+ * followed by at least H265_BS_PADDING readable bytes (their contents do not
+ * matter): the NAL units parsed in place (VCL NAL units, and NAL units of
+ * which only the header is parsed) are then read with whole word loads up to
+ * their end, see h265_bs_cinit_padded() */
+#define H265_READER_FLAGS_PADDED (1 << 8)
+
+
 H265_API
 int h265_reader_new(const struct h265_ctx_cbs *cbs,
 		    void *userdata,
@@ -57,6 +110,43 @@ int h265_reader_parse(struct h265_reader *reader,
 		      size_t *off);
 
 
+/**
+ * Parse a buffer of NAL units each preceded by its size as a big-endian
+ * integer, such as an MP4 sample with the length size given by the
+ * lengthSizeMinusOne field of the hvcC record. The NAL units are parsed in
+ * place, the buffer is not modified. H265_READER_FLAGS_STREAM is not
+ * supported.
+ *
+ * @param reader Reader handle
+ * @param flags Reader flags
+ * @param buf,len Buffer to parse
+ * @param length_size Size in bytes of the NAL unit lengths: 1, 2 or 4
+ *
+ * @return 0 on success, -EPROTO if a NAL unit length is invalid, negative
+ * errno value in case of error
+ */
+H265_API
+int h265_reader_parse_length_prefixed(struct h265_reader *reader,
+				      uint32_t flags,
+				      const uint8_t *buf,
+				      size_t len,
+				      uint32_t length_size);
+
+
+/**
+ * Parse the NAL unit left incomplete by the last h265_reader_parse() call
+ * in streaming mode (H265_READER_FLAGS_STREAM), at the end of the stream.
+ * The streaming state is then reset, and the pictures left in the DPB model
+ * are output, see h265_ctx_dpb_flush().
+ *
+ * @param reader Reader handle
+ *
+ * @return 0 on success, negative errno value in case of error
+ */
+H265_API
+int h265_reader_flush(struct h265_reader *reader);
+
+
 H265_API
 int h265_reader_parse_nalu(struct h265_reader *reader,
 			   uint32_t flags,
@@ -0,0 +1,265 @@
+/**
+ * Copyright (c) 2019 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Drones SAS Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT DRONES SAS COMPANY BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _H265_RTP_H_
+#define _H265_RTP_H_
+
+
+/**
+ * RTP payload format for HEVC (RFC 7798)
+ */
+
+/* 4.4 Payload types (NAL unit types of the payload header) */
+#define H265_RTP_TYPE_AP 48
+#define H265_RTP_TYPE_FU 49
+#define H265_RTP_TYPE_PACI 50
+
+
+/**
+ * Depacketizer: the NAL units of single NAL unit packets, aggregation
+ * packets (AP) and fragmentation units (FU) are extracted from the RTP
+ * packets and given in transmission order, the access units ending on the
+ * RTP marker bit.
+ */
+struct h265_rtp_depay;
+
+
+struct h265_rtp_depay_cfg {
+	/* sprop-max-don-diff of the session: when greater than 0, the
+	 * payloads include the DONL and DOND fields (4.4) */
+	uint32_t max_don_diff;
+
+	/* Optional reader the NAL units are given to with
+	 * h265_reader_parse_nalu() (after the nalu callback), or NULL;
+	 * H265_READER_FLAGS_STREAM and H265_READER_FLAGS_PADDED are not
+	 * supported */
+	struct h265_reader *reader;
+	uint32_t reader_flags;
+};
+
+
+/* NAL unit extracted by the depacketizer */
+struct h265_rtp_nalu_info {
+	/* RTP timestamp */
+	uint32_t timestamp;
+
+	/* Sequence number of the RTP packet holding the NAL unit (the last
+	 * fragment for a fragmented NAL unit) */
+	uint16_t seq_num;
+
+	/* Decoding order number (only valid when max_don_diff is greater than
+	 * 0); the NAL units are not reordered by the depacketizer */
+	uint16_t don;
+
+	/* 1 if the NAL unit was fragmented (FU), 0 otherwise */
+	int fragmented;
+};
+
+
+struct h265_rtp_depay_stats {
+	/* Number of RTP packets received */
+	uint64_t packets;
+
+	/* Number of RTP packets lost (sequence number gaps) */
+	uint64_t lost_packets;
+
+	/* Number of invalid, duplicate or late RTP packets dropped */
+	uint64_t dropped_packets;
+
+	/* Number of NAL units output */
+	uint64_t nalus;
+
+	/* Number of fragmented NAL units dropped because of a loss */
+	uint64_t dropped_nalus;
+
+	/* Number of access units ended */
+	uint64_t aus;
+
+	/* Number of access units ended with a loss */
+	uint64_t incomplete_aus;
+};
+
+
+struct h265_rtp_depay_cbs {
+	/* Called for each NAL unit; buf is only valid during the call (it is
+	 * either in the RTP packet or in the FU reassembly buffer) */
+	void (*nalu)(struct h265_rtp_depay *depay,
+		     const uint8_t *buf,
+		     size_t len,
+		     const struct h265_rtp_nalu_info *info,
+		     void *userdata);
+
+	/* Called at the end of an access unit: after a packet with the
+	 * marker bit set, or before the first NAL unit with a new timestamp
+	 * if the marker bit was not received; complete is 0 if packets were
+	 * lost during the access unit */
+	void (*au_end)(struct h265_rtp_depay *depay,
+		       uint32_t timestamp,
+		       int complete,
+		       void *userdata);
+};
+
+
+H265_API
+int h265_rtp_depay_new(const struct h265_rtp_depay_cfg *cfg,
+		       const struct h265_rtp_depay_cbs *cbs,
+		       void *userdata,
+		       struct h265_rtp_depay **ret_obj);
+
+
+H265_API
+int h265_rtp_depay_destroy(struct h265_rtp_depay *depay);
+
+
+/**
+ * Process an RTP packet (RFC 3550 header included). The NAL units of APs,
+ * and of single NAL unit packets without DONL field (max_don_diff of 0), are
+ * given without copy; the single NAL units with a DONL field to remove are
+ * copied, and the FUs are reassembled, in a buffer kept between packets.
+ * A sequence number gap drops the NAL unit being reassembled and marks the
+ * current access unit as incomplete; duplicate and late packets are
+ * dropped, unless several of them follow each other, in which case the
+ * sequence is restarted as after a gap.
+ *
+ * @param depay Depacketizer handle
+ * @param buf,len RTP packet
+ *
+ * @return 0 on success, -EPROTO if the packet is invalid, negative errno
+ * value in case of error
+ */
+H265_API
+int h265_rtp_depay_process(struct h265_rtp_depay *depay,
+			   const uint8_t *buf,
+			   size_t len);
+
+
+/**
+ * End the current access unit if it was not ended by a marker bit, and
+ * drop the NAL unit being reassembled, if any (e.g. at the end of the
+ * session).
+ *
+ * @param depay Depacketizer handle
+ *
+ * @return 0 on success, negative errno value in case of error
+ */
+H265_API
+int h265_rtp_depay_flush(struct h265_rtp_depay *depay);
+
+
+H265_API
+int h265_rtp_depay_get_stats(struct h265_rtp_depay *depay,
+			     struct h265_rtp_depay_stats *stats);
+
+
+/**
+ * Packetizer: the NAL units of an access unit are sent in single NAL unit
+ * packets, aggregated in APs when several of them fit in a packet, or
+ * fragmented in FUs when they do not fit in a packet. The packets reference
+ * the NAL unit data of the caller, which is never copied.
+ */
+struct h265_rtp_pay;
+
+
+struct h265_rtp_pay_cfg {
+	/* Maximum size of the RTP packets, RTP header included */
+	size_t mtu;
+
+	/* RTP header fields: payload type, SSRC and sequence number of the
+	 * first packet */
+	uint8_t payload_type;
+	uint32_t ssrc;
+	uint16_t seq_num;
+};
+
+
+/* NAL unit of an access unit to send (without start code) */
+struct h265_rtp_pay_nalu {
+	const uint8_t *buf;
+	size_t len;
+};
+
+
+/* RTP packet built by the packetizer */
+struct h265_rtp_packet {
+	/* Buffers of the packet, in order: the RTP header and the payload
+	 * headers are owned by the packetizer, the NAL unit data references
+	 * the NAL units given to h265_rtp_pay_process() */
+	const struct iovec *iov;
+	size_t iov_count;
+
+	/* Total size of the packet */
+	size_t len;
+
+	uint16_t seq_num;
+
+	/* 1 for the last packet of the access unit, 0 otherwise */
+	int marker;
+};
+
+
+struct h265_rtp_pay_cbs {
+	/* Called with all the packets of an access unit, e.g. to send them
+	 * with a single sendmmsg() call; the packets are only valid during
+	 * the call */
+	void (*packets)(struct h265_rtp_pay *pay,
+			const struct h265_rtp_packet *packets,
+			size_t count,
+			void *userdata);
+};
+
+
+H265_API
+int h265_rtp_pay_new(const struct h265_rtp_pay_cfg *cfg,
+		     const struct h265_rtp_pay_cbs *cbs,
+		     void *userdata,
+		     struct h265_rtp_pay **ret_obj);
+
+
+H265_API
+int h265_rtp_pay_destroy(struct h265_rtp_pay *pay);
+
+
+/**
+ * Packetize an access unit. Consecutive NAL units fitting together in a
+ * packet (e.g. VPS, SPS, PPS and SEI) are aggregated in an AP, the NAL
+ * units larger than a packet are fragmented in FUs, and the marker bit is
+ * set on the last packet; the packets callback is then called. No DONL
+ * field is written (sprop-max-don-diff is 0).
+ *
+ * @param pay Packetizer handle
+ * @param nalus,count NAL units of the access unit, in decoding order
+ * @param timestamp RTP timestamp of the access unit
+ *
+ * @return 0 on success, negative errno value in case of error
+ */
+H265_API
+int h265_rtp_pay_process(struct h265_rtp_pay *pay,
+			 const struct h265_rtp_pay_nalu *nalus,
+			 size_t count,
+			 uint32_t timestamp);
+
+
+#endif /* !_H265_RTP_H_ */
@@ -857,6 +857,139 @@ struct h265_pps {
 };
 
 
+/**
+ * 7.4.7.1 Table 7-7 Name association to slice_type
+ */
+enum h265_slice_type {
+	H265_SLICE_TYPE_B = 0,
+	H265_SLICE_TYPE_P = 1,
+	H265_SLICE_TYPE_I = 2,
+};
+
+
+/**
+ * Justification:
+ * - 7.4.7.1: num_ref_idx_l0_active_minus1 and num_ref_idx_l1_active_minus1
+ * in [0, 14]
+ */
+#define REF_IDX_MAX 15
+
+
+/**
+ * 7.3.6.2 Reference picture list modification syntax
+ */
+struct h265_ref_pic_lists_modification {
+	int ref_pic_list_modification_flag_l0;
+	uint32_t list_entry_l0[REF_IDX_MAX];
+	int ref_pic_list_modification_flag_l1;
+	uint32_t list_entry_l1[REF_IDX_MAX];
+};
+
+
+/**
+ * 7.3.6.3 Weighted prediction parameters syntax
+ */
+struct h265_pred_weight_table {
+	uint32_t luma_log2_weight_denom;
+	int32_t delta_chroma_log2_weight_denom;
+
+	int luma_weight_l0_flag[REF_IDX_MAX];
+	int chroma_weight_l0_flag[REF_IDX_MAX];
+	int32_t delta_luma_weight_l0[REF_IDX_MAX];
+	int32_t luma_offset_l0[REF_IDX_MAX];
+	int32_t delta_chroma_weight_l0[REF_IDX_MAX][2];
+	int32_t delta_chroma_offset_l0[REF_IDX_MAX][2];
+
+	int luma_weight_l1_flag[REF_IDX_MAX];
+	int chroma_weight_l1_flag[REF_IDX_MAX];
+	int32_t delta_luma_weight_l1[REF_IDX_MAX];
+	int32_t luma_offset_l1[REF_IDX_MAX];
+	int32_t delta_chroma_weight_l1[REF_IDX_MAX][2];
+	int32_t delta_chroma_offset_l1[REF_IDX_MAX][2];
+};
+
+
+/**
+ * 7.3.6.1 General slice segment header syntax
+ *
+ * For a dependent slice segment, only the fields up to slice_segment_address
+ * and the fields from num_entry_point_offsets are read; the other ones are
+ * those of the preceding independent slice segment (7.4.7.1).
+ */
+struct h265_slice_header {
+	int first_slice_segment_in_pic_flag;
+	int no_output_of_prior_pics_flag;
+	uint32_t slice_pic_parameter_set_id;
+	int dependent_slice_segment_flag;
+	uint32_t slice_segment_address;
+
+	/* Range of num_extra_slice_header_bits is 0-7 */
+	int slice_reserved_flag[8];
+
+	uint32_t slice_type;
+	int pic_output_flag;
+	uint32_t colour_plane_id;
+	uint32_t slice_pic_order_cnt_lsb;
+	int short_term_ref_pic_set_sps_flag;
+
+	/* RPS of the slice header, only valid if
+	 * short_term_ref_pic_set_sps_flag is 0 */
+	struct h265_st_ref_pic_set st_ref_pic_set;
+
+	uint32_t short_term_ref_pic_set_idx;
+
+	/* Range of num_long_term_sps + num_long_term_pics is 0-32 */
+	uint32_t num_long_term_sps;
+	uint32_t num_long_term_pics;
+	uint32_t lt_idx_sps[32];
+	uint32_t poc_lsb_lt[32];
+	int used_by_curr_pic_lt_flag[32];
+	int delta_poc_msb_present_flag[32];
+	uint32_t delta_poc_msb_cycle_lt[32];
+
+	int slice_temporal_mvp_enabled_flag;
+	int slice_sao_luma_flag;
+	int slice_sao_chroma_flag;
+	int num_ref_idx_active_override_flag;
+	uint32_t num_ref_idx_l0_active_minus1;
+	uint32_t num_ref_idx_l1_active_minus1;
+
+	struct h265_ref_pic_lists_modification ref_pic_lists_modification;
+
+	int mvd_l1_zero_flag;
+	int cabac_init_flag;
+	int collocated_from_l0_flag;
+	uint32_t collocated_ref_idx;
+
+	struct h265_pred_weight_table pred_weight_table;
+
+	uint32_t five_minus_max_num_merge_cand;
+	int use_integer_mv_flag;
+	int32_t slice_qp_delta;
+	int32_t slice_cb_qp_offset;
+	int32_t slice_cr_qp_offset;
+	int32_t slice_act_y_qp_offset;
+	int32_t slice_act_cb_qp_offset;
+	int32_t slice_act_cr_qp_offset;
+	int cu_chroma_qp_offset_enabled_flag;
+	int deblocking_filter_override_flag;
+	int slice_deblocking_filter_disabled_flag;
+	int32_t slice_beta_offset_div2;
+	int32_t slice_tc_offset_div2;
+	int slice_loop_filter_across_slices_enabled_flag;
+
+	uint32_t num_entry_point_offsets;
+	uint32_t offset_len_minus1;
+
+	/* num_entry_point_offsets elements */
+	uint32_t *entry_point_offset_minus1;
+
+	/* Range is 0-256 */
+	uint32_t slice_segment_header_extension_length;
+	uint8_t slice_segment_header_extension_data_byte[256];
+};
+
+
 /* Extra info from parameter sets */
 struct h265_info {
 	/* Picture width in pixels */
@@ -934,6 +1067,136 @@ struct h265_info {
 };
 
 
+/* HEVC decoder configuration record (ISO/IEC 14496-15 8.3.3.1), without the
+ * parameter set arrays */
+struct h265_hvcc {
+	/* Range is 1 */
+	uint32_t configuration_version;
+
+	/* Profile, tier and level of the SPS (general_* of
+	 * profile_tier_level()) */
+	uint32_t general_profile_space;
+	int general_tier_flag;
+	uint32_t general_profile_idc;
+	uint32_t general_profile_compatibility_flags;
+	uint64_t general_constraint_indicator_flags;
+	uint32_t general_level_idc;
+
+	/* Range is 0-4095 */
+	uint32_t min_spatial_segmentation_idc;
+
+	/* 0: mixed or unknown, 1: slice based, 2: tile based,
+	 * 3: entropy coding sync (wavefront) based */
+	uint32_t parallelism_type;
+
+	uint32_t chroma_format_idc;
+	uint32_t bit_depth_luma_minus8;
+	uint32_t bit_depth_chroma_minus8;
+
+	/* Average frame rate in frames per 256 seconds (0 if unspecified) */
+	uint32_t avg_frame_rate;
+
+	/* 0: unknown, 1: constant frame rate, 2: constant frame rate for each
+	 * temporal layer */
+	uint32_t constant_frame_rate;
+
+	/* sps_max_sub_layers_minus1 + 1 (0 if unknown) */
+	uint32_t num_temporal_layers;
+
+	/* sps_temporal_id_nesting_flag */
+	int temporal_id_nested;
+
+	/* Size in bytes of the NAL unit lengths of the samples, minus 1;
+	 * range is 0, 1 or 3 */
+	uint32_t length_size_minus_one;
+};
+
+
+/* Class of a picture according to its NAL unit type (7.4.2.2, Table 7-1) */
+enum h265_pic_class {
+	/* Trailing picture (TRAIL, TSA or STSA) */
+	H265_PIC_CLASS_TRAILING = 0,
+
+	/* Random access decodable leading picture */
+	H265_PIC_CLASS_RADL,
+
+	/* Random access skipped leading picture */
+	H265_PIC_CLASS_RASL,
+
+	/* Intra random access point picture (IDR, BLA or CRA) */
+	H265_PIC_CLASS_IRAP,
+
+	/* Reserved NAL unit type */
+	H265_PIC_CLASS_UNKNOWN,
+};
+
+
+/* Access unit information (base layer picture) */
+struct h265_au_info {
+	/* NAL unit type of the first slice segment */
+	enum h265_nalu_type nal_unit_type;
+
+	/* Picture class derived from nal_unit_type */
+	enum h265_pic_class pic_class;
+
+	/* TemporalId */
+	uint32_t temporal_id;
+
+	/* B if the picture has a B slice, otherwise P if it has a P slice,
+	 * otherwise I */
+	enum h265_slice_type slice_type;
+
+	/* 1: poc is valid; 0 otherwise (slice segment header not parsed, or
+	 * no IRAP picture since the start of the stream or the last end of
+	 * sequence) */
+	int poc_valid;
+
+	/* PicOrderCntVal (8.3.1) */
+	int32_t poc;
+
+	/* NoRaslOutputFlag of the IRAP picture the picture is associated
+	 * with (the picture itself if it is an IRAP picture) */
+	int no_rasl_output_flag;
+
+	/* PicOutputFlag (8.1.3): 0 for a RASL picture associated with an IRAP
+	 * picture with NoRaslOutputFlag equal to 1, pic_output_flag
+	 * otherwise */
+	int pic_output_flag;
+
+	/* Decoding order number of the picture since the start of the
+	 * stream */
+	uint64_t decode_index;
+
+	/* Number of pictures in the DPB model (C.5.2) once the picture is
+	 * stored, 0 if the POC is not valid */
+	uint32_t dpb_fullness;
+};
+
+
+/* Picture output by the DPB model (C.5.2), see the dpb_output callback */
+struct h265_dpb_output {
+	/* PicOrderCntVal of the output picture */
+	int32_t poc;
+
+	/* Decoding order number of the output picture */
+	uint64_t decode_index;
+
+	/* Decoding order number of the picture whose decoding causes the
+	 * output */
+	uint64_t output_index;
+
+	/* Output latency in pictures: number of pictures decoded after the
+	 * output picture until its output (output_index - decode_index) */
+	uint32_t latency;
+
+	/* 1 if the output results from the emptying of the DPB by an IRAP
+	 * picture with NoRaslOutputFlag equal to 1, by an end of sequence or
+	 * end of bitstream NAL unit, or by h265_ctx_dpb_flush(), 0
+	 * otherwise */
+	int flush;
+};
+
+
 H265_API
 int h265_delta_dlt_clear(struct h265_delta_dlt *dlt);
 
@@ -962,4 +1225,12 @@ H265_API
 const char *h265_sei_type_str(enum h265_sei_type val);
 
 
+H265_API
+const char *h265_slice_type_str(enum h265_slice_type val);
+
+
+H265_API
+const char *h265_pic_class_str(enum h265_pic_class val);
+
+
 #endif /* !_H265_TYPES_H_ */
@@ -270,24 +270,20 @@ int h265_sar_to_aspect_ratio_idc(unsigned int sar_width,
 
 static int find_start_code(const uint8_t *buf, size_t len, size_t *start)
 {
-	const uint8_t *p = buf;
+	size_t i = 0;
 
-	while (len >= 4) {
-		/* Search for the next 0x00 byte */
-		if (*p != 0x00)
-			goto next;
+	while (len - i >= 4) {
+		/* Search for the next 00 00 0x (x <= 1) sequence */
+		i += h265_scan_start_code(buf + i, len - i);
+		if (len - i < 4)
+			break;
 
 		/* Is it a 00 00 00 01 sequence? */
-		if (p[1] == 0x00 && p[2] == 0x00 && p[3] == 0x01) {
-			*start = p - buf;
+		if (buf[i + 2] == 0x00 && buf[i + 3] == 0x01) {
+			*start = i;
 			return 0;
 		}
-
-		/* clang-format off */
-next:
-		/* clang-format on */
-		p++;
-		len--;
+		i++;
 	}
 
 	return -ENOENT;
@@ -335,6 +331,160 @@ int h265_byte_stream_to_hvcc(uint8_t *data, size_t len)
 }
 
 
+/* Sequential writer to the buffers of an iovec list */
+struct iov_writer {
+	const struct iovec *iov;
+
+	/* Current buffer, and offset in this buffer */
+	size_t idx;
+	size_t off;
+};
+
+
+static void iov_write(struct iov_writer *w, const uint8_t *buf, size_t len)
+{
+	while (len > 0) {
+		const struct iovec *iov = &w->iov[w->idx];
+		size_t n = iov->iov_len - w->off;
+		if (n == 0) {
+			w->idx++;
+			w->off = 0;
+			continue;
+		}
+		if (n > len)
+			n = len;
+		memcpy((uint8_t *)iov->iov_base + w->off, buf, n);
+		w->off += n;
+		buf += n;
+		len -= n;
+	}
+}
+
+
+static int byte_stream_to_hvcc(const uint8_t *buf,
+			       size_t len,
+			       uint32_t length_size,
+			       const struct iovec *iov,
+			       size_t iov_count,
+			       size_t *out_len)
+{
+	int res;
+	struct h265_nalu_span local[64];
+	struct h265_nalu_span *spans = local;
+	size_t count = 0, need = 0, size = 0;
+	struct iov_writer w = {
+		.iov = iov,
+	};
+	uint8_t prefix[4];
+
+	/* Index all the NAL units in a single pass, using a heap array only
+	 * if there are too many of them */
+	res = h265_find_nalus(buf, len, local, ARRAY_SIZE(local), &count);
+	if (res < 0)
+		return res;
+	if (count > ARRAY_SIZE(local)) {
+		spans = malloc(count * sizeof(*spans));
+		if (spans == NULL)
+			return -ENOMEM;
+		res = h265_find_nalus(buf, len, spans, count, &count);
+		if (res < 0)
+			goto out;
+	}
+
+	for (size_t i = 0; i < count; i++) {
+		/* The last NAL unit ends with the buffer: remove the
+		 * trailing_zero_8bits (the last byte of a NAL unit is not 0,
+		 * see 7.4.2) */
+		while (spans[i].len > 0 &&
+		       buf[spans[i].off + spans[i].len - 1] == 0x00)
+			spans[i].len--;
+		if (spans[i].len == 0)
+			continue;
+		if (length_size < 4 &&
+		    (spans[i].len >> (8 * length_size)) != 0) {
+			ULOGE("%s: invalid NALU size (%zu)",
+			      __func__,
+			      spans[i].len);
+			res = -EPROTO;
+			goto out;
+		}
+		need += length_size + spans[i].len;
+	}
+
+	*out_len = need;
+	if (iov == NULL)
+		goto out;
+	for (size_t i = 0; i < iov_count; i++)
+		size += iov[i].iov_len;
+	if (size < need) {
+		res = -ENOBUFS;
+		goto out;
+	}
+
+	for (size_t i = 0; i < count; i++) {
+		if (spans[i].len == 0)
+			continue;
+		for (uint32_t j = 0; j < length_size; j++) {
+			prefix[j] = (spans[i].len >>
+				     (8 * (length_size - 1 - j))) &
+				    0xff;
+		}
+		iov_write(&w, prefix, length_size);
+		iov_write(&w, &buf[spans[i].off], spans[i].len);
+	}
+
+out:
+	if (spans != local)
+		free(spans);
+	return res;
+}
+
+
+int h265_byte_stream_to_hvcc_copy(const uint8_t *buf,
+				  size_t len,
+				  uint32_t length_size,
+				  uint8_t *out,
+				  size_t out_size,
+				  size_t *out_len)
+{
+	struct iovec iov = {
+		.iov_base = out,
+		.iov_len = out_size,
+	};
+
+	ULOG_ERRNO_RETURN_ERR_IF(buf == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(length_size != 1 && length_size != 2 &&
+					 length_size != 4,
+				 EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(out_len == NULL, EINVAL);
+
+	return byte_stream_to_hvcc(buf,
+				   len,
+				   length_size,
+				   out != NULL ? &iov : NULL,
+				   1,
+				   out_len);
+}
+
+
+int h265_byte_stream_to_hvcc_iov(const uint8_t *buf,
+				 size_t len,
+				 uint32_t length_size,
+				 const struct iovec *iov,
+				 size_t iov_count,
+				 size_t *out_len)
+{
+	ULOG_ERRNO_RETURN_ERR_IF(buf == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(length_size != 1 && length_size != 2 &&
+					 length_size != 4,
+				 EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(out_len == NULL, EINVAL);
+
+	return byte_stream_to_hvcc(
+		buf, len, length_size, iov, iov_count, out_len);
+}
+
+
 int h265_hvcc_to_byte_stream(uint8_t *data, size_t len)
 {
 	uint32_t nalu_len, start_code = htonl(0x00000001);
@@ -357,3 +507,427 @@ int h265_hvcc_to_byte_stream(uint8_t *data, size_t len)
 
 	return 0;
 }
+
+
+/* ISO/IEC 14496-15 8.3.3.1.2: size of the record fields preceding the
+ * parameter set arrays */
+#define H265_HVCC_HEADER_SIZE 23
+
+
+static uint32_t hvcc_read_u16(const uint8_t *buf)
+{
+	return ((uint32_t)buf[0] << 8) | buf[1];
+}
+
+
+static void hvcc_write_u16(uint8_t *buf, uint32_t val)
+{
+	buf[0] = (val >> 8) & 0xff;
+	buf[1] = val & 0xff;
+}
+
+
+/* Parse a parameter set of a record and set it in the context */
+static int hvcc_set_ps(struct h265_ctx *ctx,
+		       enum h265_nalu_type type,
+		       const uint8_t *buf,
+		       size_t len)
+{
+	switch (type) {
+	case H265_NALU_TYPE_VPS_NUT:
+	case H265_NALU_TYPE_SPS_NUT:
+	case H265_NALU_TYPE_PPS_NUT:
+		return h265_ctx_set_ps_from_nalu(
+			ctx, NULL, type, buf, len, 0, NULL);
+	default:
+		ULOGD("%s: ignoring %s NALU",
+		      __func__,
+		      h265_nalu_type_str(type));
+		return 0;
+	}
+}
+
+
+int h265_hvcc_parse(const uint8_t *buf,
+		    size_t len,
+		    struct h265_ctx *ctx,
+		    struct h265_hvcc *hvcc)
+{
+	int res;
+	struct h265_hvcc rec = {0};
+	size_t off = H265_HVCC_HEADER_SIZE;
+	uint32_t num_arrays;
+
+	ULOG_ERRNO_RETURN_ERR_IF(buf == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(ctx == NULL, EINVAL);
+
+	if (len < H265_HVCC_HEADER_SIZE) {
+		ULOGE("%s: invalid record size (%zu)", __func__, len);
+		return -EPROTO;
+	}
+
+	rec.configuration_version = buf[0];
+	if (rec.configuration_version != 1) {
+		ULOGE("%s: unsupported configuration version (%u)",
+		      __func__,
+		      rec.configuration_version);
+		return -EPROTO;
+	}
+	rec.general_profile_space = buf[1] >> 6;
+	rec.general_tier_flag = (buf[1] >> 5) & 0x1;
+	rec.general_profile_idc = buf[1] & 0x1f;
+	rec.general_profile_compatibility_flags =
+		(hvcc_read_u16(&buf[2]) << 16) | hvcc_read_u16(&buf[4]);
+	for (size_t i = 6; i < 12; i++) {
+		rec.general_constraint_indicator_flags =
+			(rec.general_constraint_indicator_flags << 8) | buf[i];
+	}
+	rec.general_level_idc = buf[12];
+	rec.min_spatial_segmentation_idc = hvcc_read_u16(&buf[13]) & 0xfff;
+	rec.parallelism_type = buf[15] & 0x3;
+	rec.chroma_format_idc = buf[16] & 0x3;
+	rec.bit_depth_luma_minus8 = buf[17] & 0x7;
+	rec.bit_depth_chroma_minus8 = buf[18] & 0x7;
+	rec.avg_frame_rate = hvcc_read_u16(&buf[19]);
+	rec.constant_frame_rate = buf[21] >> 6;
+	rec.num_temporal_layers = (buf[21] >> 3) & 0x7;
+	rec.temporal_id_nested = (buf[21] >> 2) & 0x1;
+	rec.length_size_minus_one = buf[21] & 0x3;
+	num_arrays = buf[22];
+
+	for (uint32_t i = 0; i < num_arrays; i++) {
+		enum h265_nalu_type type;
+		uint32_t num_nalus;
+
+		if (len - off < 3) {
+			ULOGE("%s: truncated record", __func__);
+			return -EPROTO;
+		}
+		type = buf[off] & 0x3f;
+		num_nalus = hvcc_read_u16(&buf[off + 1]);
+		off += 3;
+
+		for (uint32_t j = 0; j < num_nalus; j++) {
+			size_t nalu_len;
+
+			if (len - off < 2) {
+				ULOGE("%s: truncated record", __func__);
+				return -EPROTO;
+			}
+			nalu_len = hvcc_read_u16(&buf[off]);
+			off += 2;
+			if (nalu_len == 0 || nalu_len > len - off) {
+				ULOGE("%s: invalid NALU size (%zu)",
+				      __func__,
+				      nalu_len);
+				return -EPROTO;
+			}
+
+			res = hvcc_set_ps(ctx, type, &buf[off], nalu_len);
+			if (res < 0)
+				return res;
+			off += nalu_len;
+		}
+	}
+
+	if (hvcc != NULL)
+		*hvcc = rec;
+
+	return 0;
+}
+
+
+/* Parameter set NAL unit of a record being built */
+struct hvcc_nalu {
+	const uint8_t *buf;
+	size_t len;
+};
+
+
+static int hvcc_get_ps_nalu(struct h265_ctx *ctx,
+			    enum h265_nalu_type type,
+			    uint32_t id,
+			    struct hvcc_nalu *nalu)
+{
+	int res;
+	struct h265_ps_raw *raw;
+	struct h265_bitstream bs;
+	struct h265_nalu_header nh = ctx->nalu_header;
+	struct h265_vps *vps = ctx->vps;
+	struct h265_sps *sps = ctx->sps;
+	struct h265_pps *pps = ctx->pps;
+
+	switch (type) {
+	case H265_NALU_TYPE_VPS_NUT:
+		raw = &ctx->vps_raw[id];
+		ctx->vps = ctx->vps_table[id];
+		break;
+	case H265_NALU_TYPE_SPS_NUT:
+		raw = &ctx->sps_raw[id];
+		ctx->sps = ctx->sps_table[id];
+		break;
+	case H265_NALU_TYPE_PPS_NUT:
+		raw = &ctx->pps_raw[id];
+		ctx->pps = ctx->pps_table[id];
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	if (raw->buf != NULL) {
+		nalu->buf = raw->buf;
+		nalu->len = raw->len;
+		res = 0;
+		goto out;
+	}
+
+	/* Serialize the parameter set, made the current one of the context
+	 * for the writer, and keep the result so that it is done only once */
+	ctx->nalu_header = (struct h265_nalu_header){
+		.nal_unit_type = type,
+		.nuh_temporal_id_plus1 = 1,
+	};
+	h265_bs_init(&bs, NULL, 0, 1);
+	res = h265_write_nalu(&bs, ctx);
+	if (res >= 0) {
+		res = h265_ctx_set_ps_raw(
+			ctx, type, bs.data, bs.off, H265_PS_RAW_FLAGS_WRITTEN);
+	}
+	h265_bs_clear(&bs);
+	if (res < 0)
+		goto out;
+	nalu->buf = raw->buf;
+	nalu->len = raw->len;
+
+out:
+	ctx->nalu_header = nh;
+	ctx->vps = vps;
+	ctx->sps = sps;
+	ctx->pps = pps;
+	return res;
+}
+
+
+/* general_constraint_indicator_flags: the 48 bits following
+ * general_profile_compatibility_flag in profile_tier_level() (7.3.3); the
+ * flags not present in the bitstream are 0 */
+static uint64_t hvcc_constraint_flags(const struct h265_ptl_core *ptl)
+{
+	uint64_t flags = 0;
+
+	flags |= (uint64_t)!!ptl->progressive_source_flag << 47;
+	flags |= (uint64_t)!!ptl->interlaced_source_flag << 46;
+	flags |= (uint64_t)!!ptl->non_packed_constraint_flag << 45;
+	flags |= (uint64_t)!!ptl->frame_only_constraint_flag << 44;
+	flags |= (uint64_t)!!ptl->max_12bit_constraint_flag << 43;
+	flags |= (uint64_t)!!ptl->max_10bit_constraint_flag << 42;
+	flags |= (uint64_t)!!ptl->max_8bit_constraint_flag << 41;
+	flags |= (uint64_t)!!ptl->max_422chroma_constraint_flag << 40;
+	flags |= (uint64_t)!!ptl->max_420chroma_constraint_flag << 39;
+	flags |= (uint64_t)!!ptl->max_monochrome_constraint_flag << 38;
+	flags |= (uint64_t)!!ptl->intra_constraint_flag << 37;
+	flags |= (uint64_t)!!ptl->one_picture_only_constraint_flag << 36;
+	flags |= (uint64_t)!!ptl->lower_bit_rate_constraint_flag << 35;
+	flags |= (uint64_t)!!ptl->max_14bit_constraint_flag << 34;
+	flags |= (uint64_t)!!ptl->inbld_flag;
+
+	return flags;
+}
+
+
+/* Fill the record fields from the SPS and the other parameter sets */
+static void hvcc_fill(struct h265_ctx *ctx,
+		      const struct h265_sps *sps,
+		      uint32_t length_size,
+		      struct h265_hvcc *rec)
+{
+	const struct h265_ptl_core *ptl = &sps->profile_tier_level.general;
+	const struct h265_vps *vps = NULL;
+	uint32_t num_units_in_tick = 0, time_scale = 0;
+	int wpp = 0, tiles = 0, other = 0;
+
+	*rec = (struct h265_hvcc){0};
+	rec->configuration_version = 1;
+	rec->general_profile_space = ptl->profile_space;
+	rec->general_tier_flag = ptl->tier_flag;
+	rec->general_profile_idc = ptl->profile_idc;
+	for (uint32_t j = 0; j < 32; j++) {
+		rec->general_profile_compatibility_flags |=
+			(uint32_t)!!ptl->profile_compatibility_flag[j]
+			<< (31 - j);
+	}
+	rec->general_constraint_indicator_flags = hvcc_constraint_flags(ptl);
+	rec->general_level_idc = ptl->level_idc;
+	rec->chroma_format_idc = sps->chroma_format_idc;
+	rec->bit_depth_luma_minus8 = sps->bit_depth_luma_minus8;
+	rec->bit_depth_chroma_minus8 = sps->bit_depth_chroma_minus8;
+	rec->num_temporal_layers = sps->sps_max_sub_layers_minus1 + 1;
+	rec->temporal_id_nested = sps->sps_temporal_id_nesting_flag;
+	rec->length_size_minus_one = length_size - 1;
+
+	if (sps->vui_parameters_present_flag &&
+	    sps->vui.bitstream_restriction_flag) {
+		rec->min_spatial_segmentation_idc =
+			sps->vui.min_spatial_segmentation_idc;
+	}
+
+	/* Frame rate from the VUI or the VPS timing info */
+	if (sps->sps_video_parameter_set_id < ARRAY_SIZE(ctx->vps_table))
+		vps = ctx->vps_table[sps->sps_video_parameter_set_id];
+	if (sps->vui_parameters_present_flag &&
+	    sps->vui.vui_timing_info_present_flag) {
+		num_units_in_tick = sps->vui.vui_num_units_in_tick;
+		time_scale = sps->vui.vui_time_scale;
+	} else if (vps != NULL && vps->vps_timing_info_present_flag) {
+		num_units_in_tick = vps->vps_num_units_in_tick;
+		time_scale = vps->vps_time_scale;
+	}
+	if (num_units_in_tick != 0) {
+		uint64_t rate = ((uint64_t)time_scale * 256 +
+				 num_units_in_tick / 2) /
+				num_units_in_tick;
+		rec->avg_frame_rate = rate > 0xffff ? 0 : rate;
+	}
+
+	/* The parallelism type is only known if all the PPS use either
+	 * wavefront or tiles */
+	for (size_t i = 0; i < ARRAY_SIZE(ctx->pps_table); i++) {
+		const struct h265_pps *pps = ctx->pps_table[i];
+		if (pps == NULL)
+			continue;
+		if (pps->entropy_coding_sync_enabled_flag &&
+		    !pps->tiles_enabled_flag)
+			wpp = 1;
+		else if (pps->tiles_enabled_flag &&
+			 !pps->entropy_coding_sync_enabled_flag)
+			tiles = 1;
+		else
+			other = 1;
+	}
+	if (!other && wpp != tiles)
+		rec->parallelism_type = wpp ? 3 : 2;
+}
+
+
+/* Whether a parameter set is present in the context */
+static int hvcc_has_ps(struct h265_ctx *ctx,
+		       enum h265_nalu_type type,
+		       uint32_t id)
+{
+	switch (type) {
+	case H265_NALU_TYPE_VPS_NUT:
+		return id < ARRAY_SIZE(ctx->vps_table) &&
+		       ctx->vps_table[id] != NULL;
+	case H265_NALU_TYPE_SPS_NUT:
+		return id < ARRAY_SIZE(ctx->sps_table) &&
+		       ctx->sps_table[id] != NULL;
+	case H265_NALU_TYPE_PPS_NUT:
+		return id < ARRAY_SIZE(ctx->pps_table) &&
+		       ctx->pps_table[id] != NULL;
+	default:
+		return 0;
+	}
+}
+
+
+int h265_hvcc_build(struct h265_ctx *ctx,
+		    uint32_t length_size,
+		    uint8_t *buf,
+		    size_t size,
+		    size_t *len)
+{
+	int res = 0;
+	struct hvcc_nalu nalus[ARRAY_SIZE(ctx->vps_table) +
+			       ARRAY_SIZE(ctx->sps_table) +
+			       ARRAY_SIZE(ctx->pps_table)] = {0};
+	uint32_t counts[3] = {0};
+	uint32_t count = 0, num_arrays = 0, n = 0;
+	const struct h265_sps *sps = NULL;
+	struct h265_hvcc rec;
+	size_t need = H265_HVCC_HEADER_SIZE, off;
+
+	ULOG_ERRNO_RETURN_ERR_IF(ctx == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(length_size != 1 && length_size != 2 &&
+					 length_size != 4,
+				 EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(len == NULL, EINVAL);
+
+	/* Get all the NAL units first to compute the record size; the
+	 * arrays are the VPS, SPS and PPS ones, in this order */
+	for (uint32_t t = 0; t < ARRAY_SIZE(counts); t++) {
+		enum h265_nalu_type type = H265_NALU_TYPE_VPS_NUT + t;
+		for (uint32_t id = 0; id < ARRAY_SIZE(ctx->pps_table); id++) {
+			if (!hvcc_has_ps(ctx, type, id))
+				continue;
+			res = hvcc_get_ps_nalu(ctx, type, id, &nalus[count]);
+			if (res < 0)
+				goto out;
+			count++;
+			if (nalus[count - 1].len > 0xffff) {
+				ULOGE("%s: invalid NALU size (%zu)",
+				      __func__,
+				      nalus[count - 1].len);
+				res = -EPROTO;
+				goto out;
+			}
+			if (sps == NULL && type == H265_NALU_TYPE_SPS_NUT)
+				sps = ctx->sps_table[id];
+			need += 2 + nalus[count - 1].len;
+			counts[t]++;
+		}
+		if (counts[t] == 0) {
+			res = -ENOENT;
+			goto out;
+		}
+		need += 3;
+		num_arrays++;
+	}
+
+	*len = need;
+	if (buf == NULL)
+		goto out;
+	if (size < need) {
+		res = -ENOBUFS;
+		goto out;
+	}
+
+	hvcc_fill(ctx, sps, length_size, &rec);
+	buf[0] = rec.configuration_version;
+	buf[1] = (rec.general_profile_space << 6) |
+		 (rec.general_tier_flag << 5) | rec.general_profile_idc;
+	hvcc_write_u16(&buf[2], rec.general_profile_compatibility_flags >> 16);
+	hvcc_write_u16(&buf[4], rec.general_profile_compatibility_flags);
+	for (size_t i = 6; i < 12; i++) {
+		buf[i] = (rec.general_constraint_indicator_flags >>
+			  (8 * (11 - i))) &
+			 0xff;
+	}
+	buf[12] = rec.general_level_idc;
+	hvcc_write_u16(&buf[13], 0xf000 | rec.min_spatial_segmentation_idc);
+	buf[15] = 0xfc | rec.parallelism_type;
+	buf[16] = 0xfc | rec.chroma_format_idc;
+	buf[17] = 0xf8 | rec.bit_depth_luma_minus8;
+	buf[18] = 0xf8 | rec.bit_depth_chroma_minus8;
+	hvcc_write_u16(&buf[19], rec.avg_frame_rate);
+	buf[21] = (rec.constant_frame_rate << 6) |
+		  ((rec.num_temporal_layers & 0x7) << 3) |
+		  (rec.temporal_id_nested << 2) | rec.length_size_minus_one;
+	buf[22] = num_arrays;
+	off = H265_HVCC_HEADER_SIZE;
+
+	for (uint32_t t = 0; t < ARRAY_SIZE(counts); t++) {
+		/* array_completeness: all the parameter sets of this type are
+		 * in the record */
+		buf[off] = 0x80 | (H265_NALU_TYPE_VPS_NUT + t);
+		hvcc_write_u16(&buf[off + 1], counts[t]);
+		off += 3;
+		for (uint32_t j = 0; j < counts[t]; j++, n++) {
+			hvcc_write_u16(&buf[off], nalus[n].len);
+			memcpy(&buf[off + 2], nalus[n].buf, nalus[n].len);
+			off += 2 + nalus[n].len;
+		}
+	}
+
+out:
+	return res;
+}
@@ -51,68 +51,131 @@ static int h265_bs_ensure_capacity(struct h265_bitstream *bs, size_t capacity)
 }
 
 
-static int h265_bs_flush(struct h265_bitstream *bs)
+static inline void h265_bs_store_be64(uint8_t *p, uint64_t v)
+{
+#if defined(__GNUC__) && defined(__BYTE_ORDER__)
+#	if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	v = __builtin_bswap64(v);
+#	endif
+	memcpy(p, &v, sizeof(v));
+#else
+	for (int i = 0; i < 8; i++)
+		p[i] = (v >> (56 - 8 * i)) & 0xff;
+#endif
+}
+
+
+/**
+ * Store 'count' bytes (left-aligned in w) one by one, inserting an
+ * emulation_prevention_three_byte where needed.
+ */
+static int
+h265_bs_flush_bytes(struct h265_bitstream *bs, uint64_t w, uint32_t count)
 {
 	int res = 0;
+	uint8_t byte = 0;
+
+	while (count > 0) {
+		byte = w >> 56;
+		w <<= 8;
+		count--;
+		if (bs->emulation_prevention && bs->off >= 2 &&
+		    bs->data[bs->off - 2] == 0x00 &&
+		    bs->data[bs->off - 1] == 0x00 && byte <= 0x03) {
+			/* Insert escape byte */
+			res = h265_bs_ensure_capacity(bs, bs->off + 2);
+			if (res < 0)
+				return res;
+			bs->data[bs->off++] = 0x03;
+		} else {
+			res = h265_bs_ensure_capacity(bs, bs->off + 1);
+			if (res < 0)
+				return res;
+		}
+		bs->data[bs->off++] = byte;
+	}
 
-	if (bs->emulation_prevention && bs->off >= 2 &&
-	    bs->data[bs->off - 2] == 0x00 && bs->data[bs->off - 1] == 0x00 &&
-	    bs->cache <= 0x03) {
-		/* Insert escape byte */
-		res = h265_bs_ensure_capacity(bs, bs->off + 2);
-		if (res < 0)
-			return res;
-		bs->data[bs->off] = 0x03;
-		bs->data[bs->off + 1] = bs->cache;
-		bs->cache = 0;
-		bs->cachebits = 0;
-		bs->off += 2;
+	return 0;
+}
+
+
+/**
+ * Store the complete bytes of the write cache to the stream.
+ *
+ * The pending bits are the 'cachebits' least significant bits of the cache
+ * (at most 63); all complete bytes among them are written and at most 7 bits
+ * remain. Unless emulation prevention is enabled and one of the bytes is
+ * lower than or equal to 0x03 (i.e. might need to be escaped), the bytes are
+ * stored with a single 64-bit big-endian store.
+ */
+static inline int h265_bs_flush(struct h265_bitstream *bs)
+{
+	int res = 0;
+	uint32_t rem = bs->cachebits % 8;
+	uint32_t count = bs->cachebits / 8;
+	uint64_t w = 0;
+
+	if (count == 0)
 		return 0;
+
+	/* Complete bytes, left-aligned, remaining low bytes set to 0xff */
+	w = (bs->cache >> rem) << (64 - count * 8);
+	w |= (UINT64_C(1) << (64 - count * 8)) - 1;
+
+	if (bs->emulation_prevention &&
+	    ((w - UINT64_C(0x0404040404040404)) & ~w &
+	     UINT64_C(0x8080808080808080)) != 0) {
+		/* Escape byte possible */
+		res = h265_bs_flush_bytes(bs, w, count);
+	} else if (bs->off + 8 <= bs->len ||
+		   h265_bs_ensure_capacity(bs, bs->off + 8) == 0) {
+		/* Store the whole word */
+		h265_bs_store_be64(bs->data + bs->off, w);
+		bs->off += count;
 	} else {
-		res = h265_bs_ensure_capacity(bs, bs->off + 1);
-		if (res < 0)
-			return res;
-		bs->data[bs->off] = bs->cache;
-		bs->cache = 0;
-		bs->cachebits = 0;
-		bs->off++;
-		return 0;
+		/* Less than 8 bytes left in a static buffer */
+		res = h265_bs_flush_bytes(bs, w, count);
 	}
+	if (res < 0)
+		return res;
+
+	bs->cache &= (UINT64_C(1) << rem) - 1;
+	bs->cachebits = rem;
+	return 0;
 }
 
 
 /**
  * B.2 Byte stream NAL unit syntax and semantics
  */
-static int
-h265_find_start_code(const uint8_t *buf, size_t len, size_t *start, size_t *end)
+int h265_find_start_code(const uint8_t *buf,
+			 size_t len,
+			 size_t *start,
+			 size_t *end)
 {
-	const uint8_t *p = buf;
+	size_t i = 0;
 
-	while (len >= 3) {
-		/* Search for the next 0x00 byte */
-		if (*p != 0x00)
-			goto next;
+	while (len - i >= 3) {
+		/* Search for the next 00 00 0x (x <= 1) sequence */
+		i += h265_scan_start_code(buf + i, len - i);
+		if (len - i < 3)
+			break;
 
 		/* Is it a 00 00 00 01 sequence? */
-		if (len >= 4 && p[1] == 0x00 && p[2] == 0x00 && p[3] == 0x01) {
-			*start = p - buf;
-			*end = *start + 4;
-			return 0;
-		}
-
-		/* Is it a 00 00 01 sequence? */
-		if (p[1] == 0x00 && p[2] == 0x01) {
-			*start = p - buf;
-			*end = *start + 3;
-			return 0;
+		if (buf[i + 2] == 0x00) {
+			if (len - i >= 4 && buf[i + 3] == 0x01) {
+				*start = i;
+				*end = i + 4;
+				return 0;
+			}
+			i++;
+			continue;
 		}
 
-		/* clang-format off */
-next:
-		/* clang-format on */
-		p++;
-		len--;
+		/* It is a 00 00 01 sequence */
+		*start = i;
+		*end = i + 3;
+		return 0;
 	}
 
 	return -ENOENT;
@@ -125,33 +188,12 @@ next:
  */
 static int h265_find_end_code(const uint8_t *buf, size_t len, size_t *end)
 {
-	const uint8_t *p = buf;
-
-	while (len >= 3) {
-		/* Search next 0x00 byte */
-		if (*p != 0x00)
-			goto next;
-
-		/* Is it a 00 00 00 sequence? */
-		if (p[1] == 0x00 && p[2] == 0x00) {
-			*end = p - buf;
-			return 0;
-		}
-
-		/* Is it a 00 00 01 sequence? */
-		if (p[1] == 0x00 && p[2] == 0x01) {
-			*end = p - buf;
-			return 0;
-		}
-
-		/* clang-format off */
-next:
-		/* clang-format on */
-		p++;
-		len--;
-	}
-
-	return -ENOENT;
+	/* Search for the next 00 00 00 or 00 00 01 sequence */
+	size_t i = h265_scan_start_code(buf, len);
+	if (i == len)
+		return -ENOENT;
+	*end = i;
+	return 0;
 }
 
 
@@ -185,16 +227,263 @@ int h265_find_nalu(const uint8_t *buf, size_t len, size_t *start, size_t *end)
 }
 
 
+static void h265_add_nalu_span(const uint8_t *buf,
+			       size_t start,
+			       size_t end,
+			       uint32_t sc_len,
+			       struct h265_nalu_span *spans,
+			       size_t max,
+			       size_t *count)
+{
+	if (*count < max) {
+		spans[*count].off = start;
+		spans[*count].len = end - start;
+		spans[*count].start_code_len = sc_len;
+		spans[*count].type = (end > start) ? (buf[start] >> 1) & 0x3f
+						   : H265_NALU_TYPE_UNKNOWN;
+	}
+	(*count)++;
+}
+
+
+/**
+ * B.2 Byte stream NAL unit syntax and semantics
+ * B.3 Byte stream NAL unit decoding process
+ */
+int h265_find_nalus(const uint8_t *buf,
+		    size_t len,
+		    struct h265_nalu_span *spans,
+		    size_t max,
+		    size_t *count)
+{
+	size_t i = 0, start = 0;
+	uint32_t sc_len = 0;
+	int in_nalu = 0;
+
+	ULOG_ERRNO_RETURN_ERR_IF(buf == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(spans == NULL && max > 0, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(count == NULL, EINVAL);
+	*count = 0;
+
+	while (len - i >= 3) {
+		/* Search for the next 00 00 0x (x <= 1) sequence */
+		i += h265_scan_start_code(buf + i, len - i);
+		if (len - i < 3)
+			break;
+
+		/* It ends the current NAL unit, if any */
+		if (in_nalu) {
+			h265_add_nalu_span(
+				buf, start, i, sc_len, spans, max, count);
+			in_nalu = 0;
+		}
+
+		/* Is it a 00 00 01 or 00 00 00 01 sequence? */
+		if (buf[i + 2] == 0x01) {
+			sc_len = 3;
+		} else if (len - i >= 4 && buf[i + 3] == 0x01) {
+			sc_len = 4;
+		} else {
+			/* trailing_zero_8bits */
+			i++;
+			continue;
+		}
+		start = i + sc_len;
+		in_nalu = 1;
+		i = start;
+	}
+
+	/* The last NAL unit ends with the buffer */
+	if (in_nalu)
+		h265_add_nalu_span(buf, start, len, sc_len, spans, max, count);
+
+	return 0;
+}
+
+
+/**
+ * 7.4.2 NAL unit semantics (emulation_prevention_three_byte)
+ */
+int h265_nalu_to_rbsp(const uint8_t *nalu,
+		      size_t nalu_len,
+		      uint8_t *rbsp,
+		      size_t *rbsp_len,
+		      size_t *ep_pos,
+		      size_t ep_max,
+		      size_t *ep_count)
+{
+	size_t i = 0, j = 0, run = 0, out = 0, count = 0;
+
+	ULOG_ERRNO_RETURN_ERR_IF(nalu == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(rbsp == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(rbsp_len == NULL, EINVAL);
+
+	while (i + 2 < nalu_len) {
+		/* Search for the next 0x00 0x00 pair */
+		j = i + h265_scan_zero_pair(nalu + i, nalu_len - i);
+		if (j + 2 >= nalu_len)
+			break;
+
+		if (nalu[j + 2] != 0x03) {
+			/* A 0x00 third byte can start another pair */
+			i = (nalu[j + 2] == 0x00) ? j + 1 : j + 3;
+			continue;
+		}
+
+		/* Copy the pending run up to and excluding the escape byte */
+		if (rbsp + out != nalu + run)
+			memmove(rbsp + out, nalu + run, j + 2 - run);
+		out += j + 2 - run;
+		if (ep_pos != NULL && count < ep_max)
+			ep_pos[count] = j + 2;
+		count++;
+		run = j + 3;
+		i = j + 3;
+	}
+
+	/* Copy the remaining data */
+	if (rbsp + out != nalu + run)
+		memmove(rbsp + out, nalu + run, nalu_len - run);
+	out += nalu_len - run;
+
+	*rbsp_len = out;
+	if (ep_count != NULL)
+		*ep_count = count;
+	return 0;
+}
+
+
+/**
+ * Insert emulation prevention bytes while copying src to dst.
+ *
+ * The 'zeros' argument is the number of 0x00 bytes immediately preceding
+ * dst (only 0, 1 or 2+ matter). If dst is NULL, only the output length is
+ * computed.
+ */
+static size_t
+h265_ep_insert(const uint8_t *src, size_t len, uint8_t *dst, uint32_t zeros)
+{
+	size_t i = 0, j = 0, run = 0, out = 0;
+
+	/* Escapes depending on the preceding bytes: go byte by byte until
+	 * the current run of zeros is broken */
+	while (zeros > 0 && i < len) {
+		if (zeros >= 2 && src[i] <= 0x03) {
+			if (dst != NULL)
+				dst[out] = 0x03;
+			out++;
+			zeros = 0;
+		}
+		if (dst != NULL)
+			dst[out] = src[i];
+		out++;
+		zeros = (src[i] == 0x00) ? zeros + 1 : 0;
+		i++;
+	}
+	run = i;
+
+	while (i + 2 < len) {
+		/* Search for the next 0x00 0x00 pair */
+		j = i + h265_scan_zero_pair(src + i, len - i);
+		if (j + 2 >= len)
+			break;
+		if (src[j + 2] > 0x03) {
+			i = j + 3;
+			continue;
+		}
+
+		/* Copy the pending run up to the pair, then the escape byte */
+		if (dst != NULL) {
+			memcpy(dst + out, src + run, j + 2 - run);
+			dst[out + j + 2 - run] = 0x03;
+		}
+		out += j + 2 - run + 1;
+		run = j + 2;
+		i = j + 2;
+	}
+
+	/* Copy the remaining data */
+	if (dst != NULL)
+		memcpy(dst + out, src + run, len - run);
+	out += len - run;
+
+	return out;
+}
+
+
+/**
+ * 7.4.2 NAL unit semantics (emulation_prevention_three_byte)
+ */
+int h265_rbsp_to_nalu(const uint8_t *rbsp,
+		      size_t rbsp_len,
+		      uint8_t *nalu,
+		      size_t nalu_size,
+		      size_t *nalu_len)
+{
+	size_t len = 0;
+	int final_escape = 0;
+
+	ULOG_ERRNO_RETURN_ERR_IF(rbsp == NULL && rbsp_len != 0, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(nalu_len == NULL, EINVAL);
+
+	/* Size pass */
+	len = h265_ep_insert(rbsp, rbsp_len, NULL, 0);
+	final_escape = (rbsp_len > 0 && rbsp[rbsp_len - 1] == 0x00);
+	*nalu_len = len + final_escape;
+	if (nalu == NULL)
+		return 0;
+	if (nalu_size < *nalu_len)
+		return -ENOBUFS;
+
+	/* Copy pass */
+	h265_ep_insert(rbsp, rbsp_len, nalu, 0);
+	if (final_escape)
+		nalu[len] = 0x03;
+
+	return 0;
+}
+
+
+int h265_bs_write_escaped(struct h265_bitstream *bs,
+			  const uint8_t *buf,
+			  size_t len)
+{
+	int res = 0;
+	uint32_t zeros = 0;
+
+	ULOG_ERRNO_RETURN_ERR_IF(!h265_bs_byte_aligned(bs), EIO);
+
+	/* Zeros already written matter for the first escapes */
+	if (bs->off >= 1 && bs->data[bs->off - 1] == 0x00)
+		zeros = (bs->off >= 2 && bs->data[bs->off - 2] == 0x00) ? 2 : 1;
+
+	/* Size the output buffer once: use the worst case (one escape byte
+	 * every two bytes) for dynamic buffers to avoid a size pass */
+	if (bs->dynamic)
+		res = h265_bs_ensure_capacity(bs, bs->off + len + len / 2 + 1);
+	else
+		res = h265_bs_ensure_capacity(
+			bs, bs->off + h265_ep_insert(buf, len, NULL, zeros));
+	if (res < 0)
+		return res;
+
+	bs->off += h265_ep_insert(buf, len, bs->data + bs->off, zeros);
+	return 0;
+}
+
+
 /**
  * 9.1 Parsing process for Exp-Golomb codes
  */
-int h265_bs_read_bits_ue(struct h265_bitstream *bs, uint32_t *v)
+static int h265_bs_read_bits_ue_slow(struct h265_bitstream *bs, uint32_t *v)
 {
 	int leadingzeros = -1;
 	uint32_t bit = 0;
 
 	for (bit = 0; !bit; leadingzeros++) {
-		if (h265_bs_read_bits(bs, &bit, 1) < 0)
+		/* Values are at most 2^32 - 2, i.e. 31 leading zeros: fail
+		 * before reading a 33rd bit if the 32 bits read are zeros */
+		if (leadingzeros >= 31 || h265_bs_read_bits(bs, &bit, 1) < 0)
 			return -EIO;
 	}
 
@@ -204,39 +493,80 @@ int h265_bs_read_bits_ue(struct h265_bitstream *bs, uint32_t *v)
 			return -EIO;
 	}
 
-	*v = (1 << leadingzeros) - 1 + bit;
+	*v = (UINT32_C(1) << leadingzeros) - 1 + bit;
 	return leadingzeros * 2 + 1;
 }
 
 
-int h265_bs_write_bits(struct h265_bitstream *bs, uint64_t v, uint32_t n)
+/**
+ * 9.1 Parsing process for Exp-Golomb codes
+ */
+int h265_bs_read_bits_ue(struct h265_bitstream *bs, uint32_t *v)
 {
-	int res = 0;
-	uint32_t bits = 0;
-	uint32_t mask = 0;
-	uint32_t part = 0;
+	uint64_t window = 0;
+	uint32_t leadingzeros = 0;
+	uint32_t n = 0;
+
+	/* Peek as many bits as possible; errors are handled by the slow path */
+	if (bs->cachebits <= 56)
+		(void)h265_bs_refill(bs, 1);
+
+	if (bs->cachebits > 0) {
+		/* Left-align the unread bits of the cache */
+		window = bs->cache << (64 - bs->cachebits);
+		if (window != 0) {
+			/* The whole code is 2 * leadingzeros + 1 bits long and
+			 * its value is (1 << leadingzeros) + info */
+			leadingzeros = h265_clz64(window);
+			n = 2 * leadingzeros + 1;
+			if (leadingzeros < 32 && n <= bs->cachebits) {
+				*v = (uint32_t)((window >> (64 - n)) - 1);
+				bs->cachebits -= n;
+				return n;
+			}
+		}
+	}
+
+	/* Code not entirely in cache (end of stream or escape byte) */
+	return h265_bs_read_bits_ue_slow(bs, v);
+}
+
+
+/**
+ * Append up to 32 bits to the write cache.
+ *
+ * Complete bytes are only stored once at least 32 bits are pending, or when
+ * the stream gets byte-aligned so that the data and offset are up to date
+ * whenever the caller can use them.
+ */
+static inline int
+h265_bs_put_bits(struct h265_bitstream *bs, uint64_t v, uint32_t n)
+{
+	bs->cache = (bs->cache << n) | (v & ((UINT64_C(1) << n) - 1));
+	bs->cachebits += n;
+	if (bs->cachebits >= 32 || bs->cachebits % 8 == 0)
+		return h265_bs_flush(bs);
+	return 0;
+}
+
 
+int h265_bs_write_bits(struct h265_bitstream *bs, uint64_t v, uint32_t n)
+{
 	/* Ensure that 'n' is not larger than the number of digits of v */
 	ULOG_ERRNO_RETURN_ERR_IF(n > 64, EINVAL);
 
-	while (n > 0) {
-		/* Write as many bits to current byte */
-		bits = 8 - bs->cachebits;
-		if (bits >= n)
-			bits = n;
-		mask = (1 << bits) - 1;
-		part = (v >> (n - bits)) & mask;
-		bs->cache |= part << (8 - bs->cachebits - bits);
-		n -= bits;
-		bs->cachebits += bits;
-		res += bits;
-
-		/* Flush data if needed */
-		if (bs->cachebits == 8 && h265_bs_flush(bs) < 0)
+	/* Less than 32 bits are pending between calls, so the cache can take
+	 * 32 more bits at once */
+	if (n > 32) {
+		if (h265_bs_put_bits(bs, v >> 32, n - 32) < 0)
 			return -EIO;
+		if (h265_bs_put_bits(bs, v, 32) < 0)
+			return -EIO;
+	} else if (h265_bs_put_bits(bs, v, n) < 0) {
+		return -EIO;
 	}
 
-	return res;
+	return n;
 }
 
 
@@ -245,46 +575,21 @@ int h265_bs_write_bits(struct h265_bitstream *bs, uint64_t v, uint32_t n)
  */
 int h265_bs_write_bits_ue(struct h265_bitstream *bs, uint32_t v)
 {
-	/* clang-format off */
-	static const uint8_t table[256] = {
-		1,
-		1,
-		2, 2,
-		3, 3, 3, 3,
-		4, 4, 4, 4, 4, 4, 4, 4,
-		5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5,
-		6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,
-		6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,
-		7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
-		7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
-		7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
-		7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
-		8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8,
-		8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8,
-		8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8,
-		8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8,
-		8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8,
-		8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8,
-		8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8,
-		8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8,
-	};
-	/* clang-format on */
-	uint32_t n = 0;
+	int res = 0;
+	uint64_t code = (uint64_t)v + 1;
+	uint32_t n = 64 - h265_clz64(code);
 
-	if (v == 0) {
-		return h265_bs_write_bits(bs, 1, 1);
-	} else {
-		v++;
-		if (v >= 0x01000000)
-			n = 24 + table[v >> 24];
-		else if (v >= 0x00010000)
-			n = 16 + table[v >> 16];
-		else if (v >= 0x00000100)
-			n = 8 + table[v >> 8];
-		else
-			n = table[v];
-		return h265_bs_write_bits(bs, v, 2 * n - 1);
-	}
+	/* Leading zeros and code word at once when it fits in 64 bits */
+	if (2 * n - 1 <= 64)
+		return h265_bs_write_bits(bs, code, 2 * n - 1);
+
+	res = h265_bs_write_bits(bs, 0, n - 1);
+	if (res < 0)
+		return res;
+	res = h265_bs_write_bits(bs, code, n);
+	if (res < 0)
+		return res;
+	return 2 * n - 1;
 }
 
 
@@ -320,39 +625,86 @@ int h265_bs_write_bits_ff_coded(struct h265_bitstream *bs, uint32_t v)
 }
 
 
+/* Whether the byte at the given offset is an emulation prevention byte */
+static inline int h265_bs_is_escape(const struct h265_bitstream *bs,
+				    size_t off)
+{
+	return bs->emulation_prevention && off >= 2 &&
+	       bs->cdata[off] == 0x03 && bs->cdata[off - 1] == 0x00 &&
+	       bs->cdata[off - 2] == 0x00;
+}
+
+
+/**
+ * 7.2 Locate the rbsp_stop_one_bit, i.e. the last bit equal to 1 in the
+ * stream: trailing zero bytes (cabac_zero_words, trailing_zero_8bits) and
+ * their emulation prevention bytes are skipped.
+ *
+ * @param bs Bitstream instance handle
+ */
+static void h265_bs_find_stop_bit(struct h265_bitstream *bs)
+{
+	size_t i = bs->len;
+	uint8_t byte = 0;
+
+	while (i > 0) {
+		byte = bs->cdata[i - 1];
+		if (byte != 0x00 &&
+		    (byte != 0x03 || !bs->emulation_prevention || i < 3 ||
+		     bs->cdata[i - 2] != 0x00 || bs->cdata[i - 3] != 0x00))
+			break;
+		i--;
+	}
+
+	bs->stop_off = (i > 0) ? i - 1 : bs->len;
+	bs->stop_zeros = 0;
+	while (i > 0 && (byte & (1 << bs->stop_zeros)) == 0)
+		bs->stop_zeros++;
+	bs->stop_found = 1;
+}
+
+
 /**
  * 7.2 Specification of syntax functions and descriptors
+ *
+ * The position of the rbsp_stop_one_bit is found on the first call (see
+ * h265_bs_find_stop_bit()): there is more data if the current position is
+ * before it.
  */
 int h265_bs_more_rbsp_data(const struct h265_bitstream *bs)
 {
-	/* Use a temp stream */
-	struct h265_bitstream bs2 = *bs;
-	uint32_t bit = 0;
+	size_t fetched = 0;
 
-	/* Try to read rbsp_stop_one_bit,
-	 * - if it fails, there is no more data
-	 * - if it is not '1', there is more data */
-	if (h265_bs_read_bits(&bs2, &bit, 1) < 0)
+	/* The stop bit position only depends on the data: it is cached in the
+	 * stream, which is not const for the callers */
+	if (!bs->stop_found)
+		h265_bs_find_stop_bit((struct h265_bitstream *)bs);
+
+	if (bs->stop_off >= bs->len)
 		return 0;
-	if (bit != 1)
-		return 1;
-
-	while (!h265_bs_byte_aligned(&bs2)) {
-		/* Try to read rbsp_alignment_zero_bit,
-		 * - if it fails, there is no more data
-		 * - if it is not '0', there is more data */
-		if (h265_bs_read_bits(&bs2, &bit, 1) < 0)
-			return 0;
-		if (bit != 0)
+
+	if (bs->off <= bs->stop_off) {
+		/* The stop byte has not been fetched yet: cached bits and bytes
+		 * before it are data (escape bytes cannot be consecutive) */
+		if (bs->cachebits > 0 || bs->off + 2 <= bs->stop_off)
 			return 1;
+		if (bs->off < bs->stop_off && !h265_bs_is_escape(bs, bs->off))
+			return 1;
+		return bs->stop_zeros < 7;
 	}
 
-	/* Have we reached end of stream? */
-	if (h265_bs_eos(&bs2))
+	/* The stop byte has been fetched: count the bits fetched after it in
+	 * the cache (at most 8 bytes, without escape bytes) */
+	if (bs->off - bs->stop_off > 16)
 		return 0;
+	for (size_t i = bs->stop_off + 1; i < bs->off; i++) {
+		if (!h265_bs_is_escape(bs, i))
+			fetched += 8;
+	}
 
-	/* Do we have a trailing_zero_8bits? */
-	return bs2.off + 1 < bs2.len || bs2.cdata[bs2.off] != 0x00;
+	/* Unread bits of the stop byte, before the rbsp_stop_one_bit */
+	return bs->cachebits > fetched &&
+	       bs->cachebits - fetched > (size_t)bs->stop_zeros + 1;
 }
 
 
@@ -390,19 +742,13 @@ int h265_bs_read_rbsp_trailing_bits(struct h265_bitstream *bs)
 int h265_bs_write_rbsp_trailing_bits(struct h265_bitstream *bs)
 {
 	int res = 0;
+	uint32_t pad = (8 - (bs->cachebits + 1) % 8) % 8;
 
-	/* Write rbsp_stop_one_bit */
-	res = h265_bs_write_bits(bs, 1, 1);
+	/* Write rbsp_stop_one_bit followed by the rbsp_alignment_zero_bit */
+	res = h265_bs_write_bits(bs, UINT64_C(1) << pad, pad + 1);
 	if (res < 0)
 		return res;
 
-	while (!h265_bs_byte_aligned(bs)) {
-		/* Write rbsp_alignment_zero_bit */
-		res = h265_bs_write_bits(bs, 0, 1);
-		if (res < 0)
-			return res;
-	}
-
 	return 0;
 }
 
@@ -410,13 +756,177 @@ int h265_bs_write_rbsp_trailing_bits(struct h265_bitstream *bs)
 int h265_bs_read_raw_bytes(struct h265_bitstream *bs, uint8_t *buf, size_t len)
 {
 	ULOG_ERRNO_RETURN_ERR_IF(!h265_bs_byte_aligned(bs), EIO);
-	ULOG_ERRNO_RETURN_ERR_IF(bs->len - bs->off != len, EIO);
+	ULOG_ERRNO_RETURN_ERR_IF(bs->len - h265_bs_read_off(bs) != len, EIO);
+
+	/* Drain the bytes already fetched in the read cache */
+	while (bs->cachebits > 0) {
+		*buf++ = (bs->cache >> (bs->cachebits - 8)) & 0xff;
+		bs->cachebits -= 8;
+		len--;
+	}
 	memcpy(buf, bs->cdata + bs->off, len);
 	bs->off += len;
 	return 0;
 }
 
 
+/**
+ * Copy bytes from a byte-aligned stream whose read cache is empty, skipping
+ * the escape bytes in bulk (with the same detection as h265_bs_fetch(): the
+ * two bytes preceding an escape byte may have been read already).
+ */
+static int
+h265_bs_read_unescaped(struct h265_bitstream *bs, uint8_t *buf, size_t len)
+{
+	size_t end, esc, i, j, n;
+
+	while (len > 0) {
+		end = (bs->len - bs->off < len) ? bs->len : bs->off + len;
+
+		/* Find the first escape byte in [off, end) */
+		esc = end;
+		i = (bs->off >= 2) ? bs->off - 2 : 0;
+		while (i + 2 < end) {
+			j = i + h265_scan_zero_pair(bs->cdata + i, end - i);
+			if (j + 2 >= end)
+				break;
+			if (bs->cdata[j + 2] == 0x03) {
+				esc = j + 2;
+				break;
+			}
+			i = j + 1;
+		}
+
+		/* Copy up to the escape byte */
+		n = esc - bs->off;
+		memcpy(buf, bs->cdata + bs->off, n);
+		buf += n;
+		len -= n;
+		bs->off += n;
+
+		if (esc < end)
+			bs->off++;
+		else if (len > 0)
+			return -EIO;
+	}
+
+	return 0;
+}
+
+
+int h265_bs_read_bytes(struct h265_bitstream *bs, uint8_t *buf, size_t len)
+{
+	int res = 0;
+	uint32_t v = 0, n = 0;
+
+	ULOG_ERRNO_RETURN_ERR_IF(bs == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(buf == NULL && len > 0, EINVAL);
+
+	if (!h265_bs_byte_aligned(bs)) {
+		/* Go through the bit reader, 4 bytes at a time */
+		while (len > 0) {
+			n = len < 4 ? len : 4;
+			res = h265_bs_read_bits(bs, &v, n * 8);
+			if (res < 0)
+				return res;
+			for (uint32_t i = 0; i < n; i++)
+				*buf++ = (v >> (8 * (n - 1 - i))) & 0xff;
+			len -= n;
+		}
+		return 0;
+	}
+
+	/* Drain the bytes already fetched (and unescaped) in the read cache */
+	while (bs->cachebits > 0 && len > 0) {
+		*buf++ = (bs->cache >> (bs->cachebits - 8)) & 0xff;
+		bs->cachebits -= 8;
+		len--;
+	}
+	if (len == 0)
+		return 0;
+
+	if (bs->emulation_prevention)
+		return h265_bs_read_unescaped(bs, buf, len);
+
+	if (len > bs->len - bs->off)
+		return -EIO;
+	memcpy(buf, bs->cdata + bs->off, len);
+	bs->off += len;
+	return 0;
+}
+
+
+int h265_bs_write_bytes(struct h265_bitstream *bs,
+			const uint8_t *buf,
+			size_t len)
+{
+	int res = 0;
+	uint32_t v = 0, n = 0;
+
+	ULOG_ERRNO_RETURN_ERR_IF(bs == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(buf == NULL && len > 0, EINVAL);
+
+	if (!h265_bs_byte_aligned(bs)) {
+		/* Go through the bit writer, 4 bytes at a time */
+		while (len > 0) {
+			n = len < 4 ? len : 4;
+			v = 0;
+			for (uint32_t i = 0; i < n; i++)
+				v = (v << 8) | *buf++;
+			res = h265_bs_write_bits(bs, v, n * 8);
+			if (res < 0)
+				return res;
+			len -= n;
+		}
+		return 0;
+	}
+
+	/* The write cache is empty when byte-aligned */
+	if (len == 0)
+		return 0;
+	if (bs->emulation_prevention)
+		return h265_bs_write_escaped(bs, buf, len);
+
+	res = h265_bs_ensure_capacity(bs, bs->off + len);
+	if (res < 0)
+		return res;
+	memcpy(bs->data + bs->off, buf, len);
+	bs->off += len;
+	return 0;
+}
+
+
+int h265_bs_skip_bytes(struct h265_bitstream *bs, size_t len)
+{
+	size_t cached = 0;
+	uint32_t v = 0;
+
+	ULOG_ERRNO_RETURN_ERR_IF(!h265_bs_byte_aligned(bs), EIO);
+
+	if (bs->emulation_prevention) {
+		/* Escape bytes have to be detected: read byte by byte */
+		for (; len > 0; len--) {
+			if (h265_bs_read_bits(bs, &v, 8) < 0)
+				return -EIO;
+		}
+		return 0;
+	}
+
+	/* Drop the bytes already fetched in the read cache first */
+	cached = bs->cachebits / 8;
+	if (len <= cached) {
+		bs->cachebits -= len * 8;
+		return 0;
+	}
+	len -= cached;
+	if (len > bs->len - bs->off)
+		return -EIO;
+	bs->cachebits = 0;
+	bs->off += len;
+	return 0;
+}
+
+
 int h265_bs_write_raw_bytes(struct h265_bitstream *bs,
 			    const uint8_t *buf,
 			    size_t len)
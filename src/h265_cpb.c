@@ -0,0 +1,330 @@
+/**
+ * Copyright (c) 2019 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Drones SAS Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT DRONES SAS COMPANY BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "h265_priv.h"
+
+
+#define H265_CPB_QUEUE_MIN_SIZE 16
+
+
+/* Access unit in the CPB */
+struct h265_cpb_entry {
+	uint64_t index;
+	uint64_t bits;
+	uint64_t initial_arrival_time;
+	uint64_t final_arrival_time;
+	uint64_t removal_time;
+};
+
+
+struct h265_cpb {
+	struct h265_cpb_params params;
+	struct h265_cpb_cbs cbs;
+	void *userdata;
+	struct h265_cpb_stats stats;
+
+	uint64_t first_arrival_time;
+	uint64_t prev_final_arrival_time;
+
+	/* Access units not removed yet, in decoding order */
+	struct h265_cpb_entry *queue;
+	size_t queue_size;
+	size_t queue_start;
+	size_t queue_count;
+};
+
+
+int h265_cpb_params_from_hrd(const struct h265_hrd *hrd,
+			     uint32_t sub_layer,
+			     int vcl,
+			     uint32_t sched_sel_idx,
+			     struct h265_cpb_params *params)
+{
+	const struct h265_sub_layer_hrd *sl_hrd;
+
+	ULOG_ERRNO_RETURN_ERR_IF(hrd == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(sub_layer >= SUB_LAYERS_MAX, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(params == NULL, EINVAL);
+
+	if (vcl ? !hrd->vcl_hrd_parameters_present_flag
+		: !hrd->nal_hrd_parameters_present_flag)
+		return -ENOENT;
+	ULOG_ERRNO_RETURN_ERR_IF(
+		sched_sel_idx > hrd->sub_layers[sub_layer].cpb_cnt_minus1,
+		EINVAL);
+
+	sl_hrd = vcl ? &hrd->sub_layers[sub_layer].vcl_hrd
+		     : &hrd->sub_layers[sub_layer].nal_hrd;
+
+	/* Equations (E-3) and (E-4) */
+	params->bit_rate =
+		((uint64_t)sl_hrd->cpbs[sched_sel_idx].bit_rate_value_minus1 +
+		 1)
+		<< (6 + hrd->bit_rate_scale);
+	params->cpb_size =
+		((uint64_t)sl_hrd->cpbs[sched_sel_idx].size_value_minus1 + 1)
+		<< (4 + hrd->cpb_size_scale);
+	params->cbr_flag = sl_hrd->cpbs[sched_sel_idx].flag;
+	params->initial_removal_delay = 0;
+
+	return 0;
+}
+
+
+int h265_cpb_new(const struct h265_cpb_params *params,
+		 const struct h265_cpb_cbs *cbs,
+		 void *userdata,
+		 struct h265_cpb **ret_obj)
+{
+	struct h265_cpb *cpb;
+
+	ULOG_ERRNO_RETURN_ERR_IF(params == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(params->bit_rate == 0, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(ret_obj == NULL, EINVAL);
+
+	cpb = calloc(1, sizeof(*cpb));
+	if (cpb == NULL)
+		return -ENOMEM;
+
+	cpb->params = *params;
+	if (cbs != NULL)
+		cpb->cbs = *cbs;
+	cpb->userdata = userdata;
+
+	*ret_obj = cpb;
+	return 0;
+}
+
+
+int h265_cpb_destroy(struct h265_cpb *cpb)
+{
+	if (cpb == NULL)
+		return 0;
+
+	free(cpb->queue);
+	free(cpb);
+
+	return 0;
+}
+
+
+/* Number of bits of an access unit arrived at a given time */
+static uint64_t h265_cpb_arrived_bits(const struct h265_cpb_entry *entry,
+				      uint64_t time)
+{
+	if (time >= entry->final_arrival_time)
+		return entry->bits;
+	if (time <= entry->initial_arrival_time)
+		return 0;
+
+	return (uint64_t)((double)entry->bits *
+			  (time - entry->initial_arrival_time) /
+			  (entry->final_arrival_time -
+			   entry->initial_arrival_time));
+}
+
+
+/* Number of bits in the CPB at a given time, all the access units arriving
+ * up to this time being known */
+static uint64_t h265_cpb_fullness(const struct h265_cpb *cpb, uint64_t time)
+{
+	uint64_t fullness = 0;
+
+	for (size_t i = 0; i < cpb->queue_count; i++) {
+		fullness += h265_cpb_arrived_bits(
+			&cpb->queue[cpb->queue_start + i], time);
+	}
+
+	return fullness;
+}
+
+
+/* Record a fullness, and return whether the CPB overflows */
+static int h265_cpb_update_fullness(struct h265_cpb *cpb, uint64_t fullness)
+{
+	if (fullness > cpb->stats.max_fullness)
+		cpb->stats.max_fullness = fullness;
+	return fullness > cpb->params.cpb_size;
+}
+
+
+/* C.2.2 Instantaneous removal of the first access unit of the CPB; returns
+ * whether the CPB overflows right before the removal */
+static int h265_cpb_remove(struct h265_cpb *cpb)
+{
+	const struct h265_cpb_entry *entry = &cpb->queue[cpb->queue_start];
+	struct h265_cpb_removal removal;
+
+	removal.index = entry->index;
+	removal.initial_arrival_time = entry->initial_arrival_time;
+	removal.final_arrival_time = entry->final_arrival_time;
+	removal.removal_time = entry->removal_time;
+	removal.fullness = h265_cpb_fullness(cpb, entry->removal_time);
+	removal.underflow =
+		entry->final_arrival_time > entry->removal_time;
+	removal.overflow = h265_cpb_update_fullness(cpb, removal.fullness);
+	if (removal.underflow)
+		cpb->stats.underflow_count++;
+	cpb->stats.removed_count++;
+
+	cpb->queue_start++;
+	cpb->queue_count--;
+	if (cpb->queue_count == 0)
+		cpb->queue_start = 0;
+
+	if (cpb->cbs.removal != NULL)
+		(*cpb->cbs.removal)(cpb, &removal, cpb->userdata);
+
+	return removal.overflow;
+}
+
+
+static int h265_cpb_push(struct h265_cpb *cpb,
+			 const struct h265_cpb_entry *entry)
+{
+	if (cpb->queue_start + cpb->queue_count == cpb->queue_size) {
+		if (cpb->queue_start > 0) {
+			memmove(cpb->queue,
+				&cpb->queue[cpb->queue_start],
+				sizeof(*cpb->queue) * cpb->queue_count);
+			cpb->queue_start = 0;
+		} else {
+			size_t size = cpb->queue_size * 2;
+			if (size < H265_CPB_QUEUE_MIN_SIZE)
+				size = H265_CPB_QUEUE_MIN_SIZE;
+			struct h265_cpb_entry *queue =
+				realloc(cpb->queue, size * sizeof(*queue));
+			if (queue == NULL)
+				return -ENOMEM;
+			cpb->queue = queue;
+			cpb->queue_size = size;
+		}
+	}
+
+	cpb->queue[cpb->queue_start + cpb->queue_count] = *entry;
+	cpb->queue_count++;
+
+	return 0;
+}
+
+
+int h265_cpb_add_au(struct h265_cpb *cpb, const struct h265_cpb_au *au)
+{
+	int res, overflow = 0;
+	struct h265_cpb_entry entry;
+	uint64_t earliest, removal_time;
+
+	ULOG_ERRNO_RETURN_ERR_IF(cpb == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(au == NULL, EINVAL);
+
+	entry.index = cpb->stats.au_count;
+	entry.bits = (uint64_t)au->size * 8;
+
+	/* C.2.2 / C.3.2: initial arrival time, the first access unit
+	 * defining the origin of the arrival times */
+	if (cpb->stats.au_count == 0) {
+		cpb->first_arrival_time = au->arrival_time;
+		entry.initial_arrival_time = 0;
+	} else if (cpb->params.cbr_flag) {
+		entry.initial_arrival_time = cpb->prev_final_arrival_time;
+	} else {
+		earliest = (au->arrival_time > cpb->first_arrival_time)
+				   ? au->arrival_time - cpb->first_arrival_time
+				   : 0;
+		entry.initial_arrival_time =
+			(earliest > cpb->prev_final_arrival_time)
+				? earliest
+				: cpb->prev_final_arrival_time;
+	}
+
+	/* Final arrival time (C-4), rounded up */
+	entry.final_arrival_time =
+		entry.initial_arrival_time +
+		(entry.bits * 1000000 + cpb->params.bit_rate - 1) /
+			cpb->params.bit_rate;
+	entry.removal_time =
+		cpb->params.initial_removal_delay + au->removal_time;
+
+	/* Initial removal delay for which the access unit is complete at its
+	 * removal time */
+	if (entry.final_arrival_time > au->removal_time &&
+	    entry.final_arrival_time - au->removal_time >
+		    cpb->stats.min_initial_removal_delay)
+		cpb->stats.min_initial_removal_delay =
+			entry.final_arrival_time - au->removal_time;
+
+	res = h265_cpb_push(cpb, &entry);
+	if (res < 0)
+		return res;
+	cpb->stats.au_count++;
+	cpb->prev_final_arrival_time = entry.final_arrival_time;
+
+	/* The following access units arrive after this one: the removals up
+	 * to its final arrival can be processed */
+	while (cpb->queue_count > 0 &&
+	       cpb->queue[cpb->queue_start].removal_time <=
+		       entry.final_arrival_time) {
+		removal_time = cpb->queue[cpb->queue_start].removal_time;
+		/* Before the arrival of this access unit, the fullness is at
+		 * most the one at the final arrival of the previous one */
+		if (h265_cpb_remove(cpb) &&
+		    removal_time > entry.initial_arrival_time)
+			overflow = 1;
+	}
+
+	/* C.4: the fullness only increases between the removals, so an
+	 * overflow during the arrival of this access unit is found at one of
+	 * these removals or at its final arrival; count it once */
+	if (h265_cpb_update_fullness(
+		    cpb, h265_cpb_fullness(cpb, entry.final_arrival_time)))
+		overflow = 1;
+	if (overflow)
+		cpb->stats.overflow_count++;
+
+	return 0;
+}
+
+
+int h265_cpb_flush(struct h265_cpb *cpb)
+{
+	ULOG_ERRNO_RETURN_ERR_IF(cpb == NULL, EINVAL);
+
+	while (cpb->queue_count > 0)
+		h265_cpb_remove(cpb);
+
+	return 0;
+}
+
+
+int h265_cpb_get_stats(struct h265_cpb *cpb, struct h265_cpb_stats *stats)
+{
+	ULOG_ERRNO_RETURN_ERR_IF(cpb == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(stats == NULL, EINVAL);
+
+	*stats = cpb->stats;
+
+	return 0;
+}
@@ -27,21 +27,141 @@
 #include "h265_priv.h"
 
 
+#define H265_ARENA_MIN_SIZE 4096
+#define H265_SEI_TABLE_MIN_SIZE 4
+
+
+static void h265_arena_free(struct h265_arena_block *block)
+{
+	while (block != NULL) {
+		struct h265_arena_block *next = block->next;
+		free(block);
+		block = next;
+	}
+}
+
+
+static struct h265_arena_block *h265_arena_block_new(size_t size)
+{
+	struct h265_arena_block *block = malloc(sizeof(*block) + size);
+	if (block == NULL)
+		return NULL;
+	block->next = NULL;
+	block->size = size;
+	block->used = 0;
+	return block;
+}
+
+
+/* Reset an arena; if it has grown beyond one block, the blocks are replaced
+ * by a single block of the total size, so that the same usage is then served
+ * without allocation */
+static struct h265_arena_block *
+h265_arena_reset(struct h265_arena_block *block)
+{
+	size_t size = 0;
+
+	if (block == NULL || block->next == NULL) {
+		if (block != NULL)
+			block->used = 0;
+		return block;
+	}
+
+	for (struct h265_arena_block *b = block; b != NULL; b = b->next)
+		size += b->size;
+	h265_arena_free(block);
+
+	/* On failure the next allocation will retry */
+	return h265_arena_block_new(size);
+}
+
+
+void *h265_ctx_sei_alloc(struct h265_ctx *ctx, size_t size)
+{
+	struct h265_arena_block *block = ctx->sei_arena;
+	void *ptr;
+
+	/* Keep allocations aligned */
+	size = (size + 7) & ~(size_t)7;
+
+	if (block == NULL || block->size - block->used < size) {
+		size_t new_size = H265_ARENA_MIN_SIZE;
+		if (block != NULL)
+			new_size = 2 * block->size;
+		while (new_size < size)
+			new_size *= 2;
+		block = h265_arena_block_new(new_size);
+		if (block == NULL)
+			return NULL;
+		block->next = ctx->sei_arena;
+		ctx->sei_arena = block;
+	}
+
+	ptr = block->data + block->used;
+	block->used += size;
+	return ptr;
+}
+
+
 static int h265_ctx_clear_sei_table(struct h265_ctx *ctx)
 {
 	ULOG_ERRNO_RETURN_ERR_IF(ctx == NULL, EINVAL);
-	for (uint32_t i = 0; i < ctx->sei_count; i++)
-		free(ctx->sei_table[i].raw.buf);
-	free(ctx->sei_table);
-	ctx->sei_table = NULL;
 	ctx->sei_count = 0;
+	ctx->sei_arena = h265_arena_reset(ctx->sei_arena);
 	return 0;
 }
 
 
+static void h265_ps_raw_clear(struct h265_ps_raw *raw)
+{
+	free(raw->buf);
+	memset(raw, 0, sizeof(*raw));
+}
+
+
+/* FNV-1a */
+static uint32_t h265_ps_raw_hash(const uint8_t *buf, size_t len)
+{
+	uint32_t hash = 0x811c9dc5;
+	for (size_t i = 0; i < len; i++)
+		hash = (hash ^ buf[i]) * 0x01000193;
+	return hash;
+}
+
+
+static struct h265_ps_raw *
+h265_ctx_get_ps_raw_table(struct h265_ctx *ctx,
+			  enum h265_nalu_type type,
+			  size_t *count)
+{
+	switch (type) {
+	case H265_NALU_TYPE_VPS_NUT:
+		*count = ARRAY_SIZE(ctx->vps_raw);
+		return ctx->vps_raw;
+	case H265_NALU_TYPE_SPS_NUT:
+		*count = ARRAY_SIZE(ctx->sps_raw);
+		return ctx->sps_raw;
+	case H265_NALU_TYPE_PPS_NUT:
+		*count = ARRAY_SIZE(ctx->pps_raw);
+		return ctx->pps_raw;
+	default:
+		*count = 0;
+		return NULL;
+	}
+}
+
+
 static void uninit(struct h265_ctx *ctx)
 {
-	h265_ctx_clear_sei_table(ctx);
+	free(ctx->sei_table);
+	h265_arena_free(ctx->sei_arena);
+	free(ctx->entry_points);
+	for (size_t i = 0; i < ARRAY_SIZE(ctx->vps_raw); ++i)
+		h265_ps_raw_clear(&ctx->vps_raw[i]);
+	for (size_t i = 0; i < ARRAY_SIZE(ctx->sps_raw); ++i)
+		h265_ps_raw_clear(&ctx->sps_raw[i]);
+	for (size_t i = 0; i < ARRAY_SIZE(ctx->pps_raw); ++i)
+		h265_ps_raw_clear(&ctx->pps_raw[i]);
 	for (size_t i = 0; i < ARRAY_SIZE(ctx->vps_table); ++i)
 		free(ctx->vps_table[i]);
 	for (size_t i = 0; i < ARRAY_SIZE(ctx->sps_table); ++i)
@@ -102,6 +222,356 @@ int h265_ctx_is_nalu_unknown(struct h265_ctx *ctx)
 }
 
 
+int h265_ctx_is_ps_unchanged(struct h265_ctx *ctx)
+{
+	return ctx == NULL ? 0 : ctx->ps_unchanged;
+}
+
+
+/* Get the id of a parameter set from the first fields of its NAL unit
+ * (7.3.2.1, 7.3.2.2 and 7.3.2.3), to look up its stored raw bytes */
+static int h265_ps_raw_get_id(enum h265_nalu_type type,
+			      const uint8_t *buf,
+			      size_t len,
+			      uint32_t *id)
+{
+	struct h265_bitstream bs;
+	uint32_t v = 0, max_sub_layers_minus1 = 0, present = 0, bits = 0;
+
+	/* The NAL unit header cannot hold an emulation prevention byte, see
+	 * h265_ctx_set_ps_from_nalu() */
+	if (len < 2)
+		return -EIO;
+	h265_bs_cinit(&bs, buf + 2, len - 2, 1);
+
+	switch (type) {
+	case H265_NALU_TYPE_VPS_NUT:
+		/* vps_video_parameter_set_id */
+		return h265_bs_read_bits(&bs, id, 4) < 0 ? -EIO : 0;
+
+	case H265_NALU_TYPE_SPS_NUT:
+		/* sps_video_parameter_set_id, sps_max_sub_layers_minus1 and
+		 * sps_temporal_id_nesting_flag */
+		if (h265_bs_read_bits(&bs, &v, 8) < 0)
+			return -EIO;
+		max_sub_layers_minus1 = (v >> 1) & 0x7;
+
+		/* profile_tier_level(1, sps_max_sub_layers_minus1) (7.3.3):
+		 * the general profile (88 bits) and level (8 bits), then the
+		 * sub-layer present flags, 16 bits with the reserved ones */
+		if (h265_bs_read_bits(&bs, &v, 96) < 0)
+			return -EIO;
+		if (max_sub_layers_minus1 > 0 &&
+		    h265_bs_read_bits(&bs, &present, 16) < 0)
+			return -EIO;
+		for (uint32_t i = 0; i < max_sub_layers_minus1; i++) {
+			if (present & (1u << (15 - 2 * i)))
+				bits += 88;
+			if (present & (1u << (14 - 2 * i)))
+				bits += 8;
+		}
+		if (bits > 0 && h265_bs_read_bits(&bs, &v, bits) < 0)
+			return -EIO;
+
+		/* sps_seq_parameter_set_id */
+		return h265_bs_read_bits_ue(&bs, id) < 0 ? -EIO : 0;
+
+	case H265_NALU_TYPE_PPS_NUT:
+		/* pps_pic_parameter_set_id */
+		return h265_bs_read_bits_ue(&bs, id) < 0 ? -EIO : 0;
+
+	default:
+		return -EINVAL;
+	}
+}
+
+
+int h265_ctx_reuse_ps(struct h265_ctx *ctx,
+		      enum h265_nalu_type type,
+		      const uint8_t *buf,
+		      size_t len,
+		      uint32_t flags)
+{
+	int res;
+	size_t count = 0;
+	uint32_t id = 0;
+	struct h265_ps_raw *table = h265_ctx_get_ps_raw_table(ctx, type, &count);
+	struct h265_ps_raw *raw = NULL;
+
+	res = h265_ps_raw_get_id(type, buf, len, &id);
+	if (res < 0 || id >= count)
+		return 0;
+
+	/* The id only locates the stored NAL unit: it must be identical */
+	raw = &table[id];
+	flags &= H265_READER_FLAGS_SKIP_VUI | H265_READER_FLAGS_SKIP_HRD;
+	if (raw->buf == NULL || raw->len != len || raw->flags != flags ||
+	    raw->hash != h265_ps_raw_hash(buf, len) ||
+	    memcmp(raw->buf, buf, len) != 0)
+		return 0;
+
+	switch (type) {
+	case H265_NALU_TYPE_VPS_NUT:
+		ctx->vps = ctx->vps_table[id];
+		break;
+	case H265_NALU_TYPE_SPS_NUT:
+		ctx->sps = ctx->sps_table[id];
+		break;
+	case H265_NALU_TYPE_PPS_NUT:
+		ctx->pps = ctx->pps_table[id];
+		break;
+	default:
+		return 0;
+	}
+	ctx->ps_unchanged = 1;
+	return 1;
+}
+
+
+int h265_ctx_set_ps_raw(struct h265_ctx *ctx,
+			enum h265_nalu_type type,
+			const uint8_t *buf,
+			size_t len,
+			uint32_t flags)
+{
+	size_t count = 0, id = 0;
+	struct h265_ps_raw *table = h265_ctx_get_ps_raw_table(ctx, type, &count);
+	struct h265_ps_raw *raw = NULL;
+
+	switch (type) {
+	case H265_NALU_TYPE_VPS_NUT:
+		ULOG_ERRNO_RETURN_ERR_IF(ctx->vps == NULL, EINVAL);
+		id = ctx->vps->vps_video_parameter_set_id;
+		break;
+	case H265_NALU_TYPE_SPS_NUT:
+		ULOG_ERRNO_RETURN_ERR_IF(ctx->sps == NULL, EINVAL);
+		id = ctx->sps->sps_seq_parameter_set_id;
+		break;
+	case H265_NALU_TYPE_PPS_NUT:
+		ULOG_ERRNO_RETURN_ERR_IF(ctx->pps == NULL, EINVAL);
+		id = ctx->pps->pps_pic_parameter_set_id;
+		break;
+	default:
+		return -EINVAL;
+	}
+	ULOG_ERRNO_RETURN_ERR_IF(id >= count, EINVAL);
+
+	raw = &table[id];
+	h265_ps_raw_clear(raw);
+	raw->buf = malloc(len);
+	if (raw->buf == NULL)
+		return -ENOMEM;
+	memcpy(raw->buf, buf, len);
+	raw->len = len;
+	raw->hash = h265_ps_raw_hash(buf, len);
+	raw->flags = flags &
+		     (H265_READER_FLAGS_SKIP_VUI | H265_READER_FLAGS_SKIP_HRD |
+		      H265_PS_RAW_FLAGS_WRITTEN);
+
+	return 0;
+}
+
+
+/* Compare a field of the stored (old) and new parameter sets, and copy it to
+ * the scratch copy (tmp) of the stored one, so that the remaining differences
+ * can be found by comparing tmp with the new parameter set; the parameter
+ * sets are always copied with memcpy() so that the padding bytes, zeroed by
+ * calloc() when parsed, are part of the comparison on both sides */
+#define H265_PS_CMP(_field, _change)                                           \
+	do {                                                                   \
+		if (memcmp(&old->_field, &ps->_field, sizeof(ps->_field)) !=   \
+		    0)                                                         \
+			changes |= (_change);                                  \
+		if (tmp != NULL)                                               \
+			memcpy(&tmp->_field, &ps->_field, sizeof(ps->_field)); \
+	} while (0)
+
+
+static uint32_t h265_vps_changes(const struct h265_vps *old,
+				 const struct h265_vps *ps)
+{
+	uint32_t changes = 0;
+	struct h265_vps *tmp = malloc(sizeof(*tmp));
+	if (tmp != NULL)
+		memcpy(tmp, old, sizeof(*tmp));
+
+	H265_PS_CMP(profile_tier_level, H265_PS_CHANGED_PROFILE);
+	H265_PS_CMP(vps_max_sub_layers_minus1, H265_PS_CHANGED_DPB);
+	H265_PS_CMP(vps_max_dec_pic_buffering_minus1, H265_PS_CHANGED_DPB);
+	H265_PS_CMP(vps_max_num_reorder_pics, H265_PS_CHANGED_DPB);
+	H265_PS_CMP(vps_max_latency_increase_plus1, H265_PS_CHANGED_DPB);
+	H265_PS_CMP(vps_timing_info_present_flag, H265_PS_CHANGED_TIMING);
+	H265_PS_CMP(vps_num_units_in_tick, H265_PS_CHANGED_TIMING);
+	H265_PS_CMP(vps_time_scale, H265_PS_CHANGED_TIMING);
+	H265_PS_CMP(vps_poc_proportional_to_timing_flag,
+		    H265_PS_CHANGED_TIMING);
+	H265_PS_CMP(vps_num_ticks_poc_diff_one_minus1, H265_PS_CHANGED_TIMING);
+	H265_PS_CMP(vps_num_hrd_parameters, H265_PS_CHANGED_HRD);
+	H265_PS_CMP(hrd_layer_set_idx, H265_PS_CHANGED_HRD);
+	H265_PS_CMP(cprms_present_flag, H265_PS_CHANGED_HRD);
+	H265_PS_CMP(hrd_parameters, H265_PS_CHANGED_HRD);
+
+	if (tmp == NULL || memcmp(tmp, ps, sizeof(*ps)) != 0)
+		changes |= H265_PS_CHANGED_OTHER;
+	free(tmp);
+
+	return changes;
+}
+
+
+static uint32_t h265_sps_changes(const struct h265_sps *old,
+				 const struct h265_sps *ps)
+{
+	uint32_t changes = 0;
+	struct h265_sps *tmp = malloc(sizeof(*tmp));
+	if (tmp != NULL)
+		memcpy(tmp, old, sizeof(*tmp));
+
+	H265_PS_CMP(profile_tier_level, H265_PS_CHANGED_PROFILE);
+	H265_PS_CMP(pic_width_in_luma_samples, H265_PS_CHANGED_RESOLUTION);
+	H265_PS_CMP(pic_height_in_luma_samples, H265_PS_CHANGED_RESOLUTION);
+	H265_PS_CMP(conformance_window_flag, H265_PS_CHANGED_CROP);
+	H265_PS_CMP(conf_win_left_offset, H265_PS_CHANGED_CROP);
+	H265_PS_CMP(conf_win_right_offset, H265_PS_CHANGED_CROP);
+	H265_PS_CMP(conf_win_top_offset, H265_PS_CHANGED_CROP);
+	H265_PS_CMP(conf_win_bottom_offset, H265_PS_CHANGED_CROP);
+	H265_PS_CMP(bit_depth_luma_minus8, H265_PS_CHANGED_BIT_DEPTH);
+	H265_PS_CMP(bit_depth_chroma_minus8, H265_PS_CHANGED_BIT_DEPTH);
+	H265_PS_CMP(chroma_format_idc, H265_PS_CHANGED_CHROMA_FORMAT);
+	H265_PS_CMP(separate_colour_plane_flag, H265_PS_CHANGED_CHROMA_FORMAT);
+	H265_PS_CMP(sps_max_sub_layers_minus1, H265_PS_CHANGED_DPB);
+	H265_PS_CMP(sps_max_dec_pic_buffering_minus1, H265_PS_CHANGED_DPB);
+	H265_PS_CMP(sps_max_num_reorder_pics, H265_PS_CHANGED_DPB);
+	H265_PS_CMP(sps_max_latency_increase_plus1, H265_PS_CHANGED_DPB);
+
+	/* E.2.1: an absent VUI is all zeros */
+	H265_PS_CMP(vui.vui_timing_info_present_flag, H265_PS_CHANGED_TIMING);
+	H265_PS_CMP(vui.vui_num_units_in_tick, H265_PS_CHANGED_TIMING);
+	H265_PS_CMP(vui.vui_time_scale, H265_PS_CHANGED_TIMING);
+	H265_PS_CMP(vui.vui_poc_proportional_to_timing_flag,
+		    H265_PS_CHANGED_TIMING);
+	H265_PS_CMP(vui.vui_num_ticks_poc_diff_one_minus1,
+		    H265_PS_CHANGED_TIMING);
+	H265_PS_CMP(vui.video_signal_type_present_flag, H265_PS_CHANGED_COLOUR);
+	H265_PS_CMP(vui.video_format, H265_PS_CHANGED_COLOUR);
+	H265_PS_CMP(vui.video_full_range_flag, H265_PS_CHANGED_COLOUR);
+	H265_PS_CMP(vui.colour_description_present_flag,
+		    H265_PS_CHANGED_COLOUR);
+	H265_PS_CMP(vui.colour_primaries, H265_PS_CHANGED_COLOUR);
+	H265_PS_CMP(vui.transfer_characteristics, H265_PS_CHANGED_COLOUR);
+	H265_PS_CMP(vui.matrix_coeffs, H265_PS_CHANGED_COLOUR);
+	H265_PS_CMP(vui.aspect_ratio_info_present_flag, H265_PS_CHANGED_SAR);
+	H265_PS_CMP(vui.aspect_ratio_idc, H265_PS_CHANGED_SAR);
+	H265_PS_CMP(vui.sar_width, H265_PS_CHANGED_SAR);
+	H265_PS_CMP(vui.sar_height, H265_PS_CHANGED_SAR);
+	H265_PS_CMP(vui.vui_hrd_parameters_present_flag, H265_PS_CHANGED_HRD);
+	H265_PS_CMP(vui.hrd, H265_PS_CHANGED_HRD);
+
+	if (tmp == NULL || memcmp(tmp, ps, sizeof(*ps)) != 0)
+		changes |= H265_PS_CHANGED_OTHER;
+	free(tmp);
+
+	return changes;
+}
+
+
+static uint32_t h265_pps_changes(const struct h265_pps *old,
+				 const struct h265_pps *ps)
+{
+	uint32_t changes = 0;
+	struct h265_pps *tmp = malloc(sizeof(*tmp));
+	if (tmp != NULL)
+		memcpy(tmp, old, offsetof(struct h265_pps, column_width_minus1));
+
+	H265_PS_CMP(tiles_enabled_flag, H265_PS_CHANGED_TILES);
+	H265_PS_CMP(num_tile_columns_minus1, H265_PS_CHANGED_TILES);
+	H265_PS_CMP(num_tile_rows_minus1, H265_PS_CHANGED_TILES);
+	H265_PS_CMP(uniform_spacing_flag, H265_PS_CHANGED_TILES);
+	H265_PS_CMP(loop_filter_across_tiles_enabled_flag,
+		    H265_PS_CHANGED_TILES);
+	H265_PS_CMP(entropy_coding_sync_enabled_flag, H265_PS_CHANGED_WPP);
+
+	/* The tile sizes are only compared if the number of tiles is unchanged
+	 * and they are explicit (the arrays are not filled otherwise) */
+	if ((changes & H265_PS_CHANGED_TILES) == 0 && ps->tiles_enabled_flag &&
+	    !ps->uniform_spacing_flag) {
+		for (uint32_t i = 0; i < ps->num_tile_columns_minus1; i++) {
+			if (old->column_width_minus1[i] !=
+			    ps->column_width_minus1[i])
+				changes |= H265_PS_CHANGED_TILES;
+		}
+		for (uint32_t i = 0; i < ps->num_tile_rows_minus1; i++) {
+			if (old->row_height_minus1[i] !=
+			    ps->row_height_minus1[i])
+				changes |= H265_PS_CHANGED_TILES;
+		}
+	}
+
+	if (tmp == NULL ||
+	    memcmp(tmp, ps, offsetof(struct h265_pps, column_width_minus1)) !=
+		    0)
+		changes |= H265_PS_CHANGED_OTHER;
+	free(tmp);
+
+	return changes;
+}
+
+#undef H265_PS_CMP
+
+
+uint32_t h265_ctx_get_ps_changes(struct h265_ctx *ctx,
+				 enum h265_nalu_type type,
+				 const void *ps)
+{
+	switch (type) {
+	case H265_NALU_TYPE_VPS_NUT: {
+		const struct h265_vps *vps = ps;
+		const struct h265_vps *old = NULL;
+		if (vps->vps_video_parameter_set_id < ARRAY_SIZE(ctx->vps_table))
+			old = ctx->vps_table[vps->vps_video_parameter_set_id];
+		return old == NULL ? H265_PS_CHANGED_NEW
+				   : h265_vps_changes(old, vps);
+	}
+	case H265_NALU_TYPE_SPS_NUT: {
+		const struct h265_sps *sps = ps;
+		const struct h265_sps *old = NULL;
+		if (sps->sps_seq_parameter_set_id < ARRAY_SIZE(ctx->sps_table))
+			old = ctx->sps_table[sps->sps_seq_parameter_set_id];
+		return old == NULL ? H265_PS_CHANGED_NEW
+				   : h265_sps_changes(old, sps);
+	}
+	case H265_NALU_TYPE_PPS_NUT: {
+		const struct h265_pps *pps = ps;
+		const struct h265_pps *old = NULL;
+		if (pps->pps_pic_parameter_set_id < ARRAY_SIZE(ctx->pps_table))
+			old = ctx->pps_table[pps->pps_pic_parameter_set_id];
+		return old == NULL ? H265_PS_CHANGED_NEW
+				   : h265_pps_changes(old, pps);
+	}
+	default:
+		return 0;
+	}
+}
+
+
+void h265_ctx_ps_changed(struct h265_ctx *ctx,
+			 const struct h265_ctx_cbs *cbs,
+			 void *userdata,
+			 enum h265_nalu_type type,
+			 uint32_t changes)
+{
+	int res;
+	struct h265_info info;
+
+	if (changes == 0 || cbs == NULL || cbs->ps_changed == NULL)
+		return;
+
+	res = h265_ctx_get_info(ctx, &info);
+	(*cbs->ps_changed)(
+		ctx, type, changes, (res == 0) ? &info : NULL, userdata);
+}
+
+
 int h265_ctx_set_aud(struct h265_ctx *ctx, const struct h265_aud *aud)
 {
 	ULOG_ERRNO_RETURN_ERR_IF(ctx == NULL, EINVAL);
@@ -122,12 +592,15 @@ int h265_ctx_set_vps(struct h265_ctx *ctx, const struct h265_vps *vps)
 	struct h265_vps **p_vps =
 		&ctx->vps_table[vps->vps_video_parameter_set_id];
 
+	/* The raw bytes no longer match */
+	h265_ps_raw_clear(&ctx->vps_raw[vps->vps_video_parameter_set_id]);
+
 	free(*p_vps);
 	*p_vps = calloc(1, sizeof(**p_vps));
 	if (*p_vps == NULL)
 		return -ENOMEM;
 
-	**p_vps = *vps;
+	memcpy(*p_vps, vps, sizeof(**p_vps));
 	ctx->vps = *p_vps;
 
 	return 0;
@@ -145,12 +618,15 @@ int h265_ctx_set_sps(struct h265_ctx *ctx, const struct h265_sps *sps)
 	struct h265_sps **p_sps =
 		&ctx->sps_table[sps->sps_seq_parameter_set_id];
 
+	/* The raw bytes no longer match */
+	h265_ps_raw_clear(&ctx->sps_raw[sps->sps_seq_parameter_set_id]);
+
 	free(*p_sps);
 	*p_sps = calloc(1, sizeof(**p_sps));
 	if (*p_sps == NULL)
 		return -ENOMEM;
 
-	**p_sps = *sps;
+	memcpy(*p_sps, sps, sizeof(**p_sps));
 	ctx->sps = *p_sps;
 
 	return 0;
@@ -206,13 +682,16 @@ int h265_ctx_set_pps(struct h265_ctx *ctx, const struct h265_pps *pps)
 	ULOG_ERRNO_RETURN_ERR_IF(ctx == NULL, EINVAL);
 	ULOG_ERRNO_RETURN_ERR_IF(pps == NULL, EINVAL);
 	int valid_id =
-		pps->pps_seq_parameter_set_id < ARRAY_SIZE(ctx->pps_table);
+		pps->pps_pic_parameter_set_id < ARRAY_SIZE(ctx->pps_table);
 	ULOG_ERRNO_RETURN_ERR_IF(!valid_id, EINVAL);
 
 	int ret;
 	struct h265_pps **p_pps =
 		&ctx->pps_table[pps->pps_pic_parameter_set_id];
 
+	/* The raw bytes no longer match */
+	h265_ps_raw_clear(&ctx->pps_raw[pps->pps_pic_parameter_set_id]);
+
 	h265_pps_clear(*p_pps);
 	free(*p_pps);
 
@@ -220,7 +699,7 @@ int h265_ctx_set_pps(struct h265_ctx *ctx, const struct h265_pps *pps)
 	if (*p_pps == NULL)
 		return -ENOMEM;
 
-	**p_pps = *pps;
+	memcpy(*p_pps, pps, sizeof(**p_pps));
 	(*p_pps)->column_width_minus1 = NULL;
 	(*p_pps)->row_height_minus1 = NULL;
 
@@ -272,6 +751,286 @@ error:
 }
 
 
+uint32_t *h265_ctx_alloc_entry_points(struct h265_ctx *ctx, uint32_t count)
+{
+	if (count >= ctx->entry_points_size) {
+		/* Never empty, so that NULL is only returned on failure */
+		size_t size = ((size_t)count + 64) & ~(size_t)63;
+		uint32_t *newtable =
+			realloc(ctx->entry_points, size * sizeof(*newtable));
+		if (newtable == NULL)
+			return NULL;
+		ctx->entry_points = newtable;
+		ctx->entry_points_size = size;
+	}
+
+	return ctx->entry_points;
+}
+
+
+int h265_ctx_set_ps_from_nalu(struct h265_ctx *ctx,
+			      struct h265_bitstream *bs,
+			      enum h265_nalu_type type,
+			      const uint8_t *buf,
+			      size_t len,
+			      uint32_t flags,
+			      uint32_t *changes)
+{
+	int res = 0;
+	uint32_t header = 0;
+	struct h265_bitstream nalu_bs;
+	struct h265_nalu_header nh;
+	size_t size = 0;
+	void *ps = NULL;
+
+	switch (type) {
+	case H265_NALU_TYPE_VPS_NUT:
+		size = sizeof(struct h265_vps);
+		break;
+	case H265_NALU_TYPE_SPS_NUT:
+		size = sizeof(struct h265_sps);
+		break;
+	case H265_NALU_TYPE_PPS_NUT:
+		size = sizeof(struct h265_pps);
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	if (bs == NULL) {
+		/* Parse the NAL unit header first */
+		res = h265_parse_nalu_header(buf, len, &nh);
+		if (res < 0)
+			return res;
+		if (nh.nal_unit_type != (uint32_t)type) {
+			ULOGE("invalid nalu type: %u (%u)",
+			      nh.nal_unit_type,
+			      (uint32_t)type);
+			return -EIO;
+		}
+		/* The header cannot hold an emulation prevention byte: its
+		 * first byte is not zero for a parameter set */
+		bs = &nalu_bs;
+		h265_bs_cinit(bs, buf, len, 1);
+		(void)h265_bs_read_bits(bs, &header, 16);
+	}
+
+	ps = calloc(1, size);
+	if (ps == NULL) {
+		res = -ENOMEM;
+		goto out;
+	}
+	res = h265_read_ps(bs, type, ps);
+	if (res < 0)
+		goto out;
+
+	if (changes != NULL)
+		*changes = h265_ctx_get_ps_changes(ctx, type, ps);
+	if (type == H265_NALU_TYPE_VPS_NUT)
+		res = h265_ctx_set_vps(ctx, ps);
+	else if (type == H265_NALU_TYPE_SPS_NUT)
+		res = h265_ctx_set_sps(ctx, ps);
+	else
+		res = h265_ctx_set_pps(ctx, ps);
+	if (res < 0)
+		goto out;
+
+	/* A failure only disables the reuse of this parameter set */
+	res = h265_ctx_set_ps_raw(ctx, type, buf, len, flags);
+	if (res < 0)
+		ULOG_ERRNO("h265_ctx_set_ps_raw", -res);
+	res = 0;
+
+out:
+	if (ps != NULL && type == H265_NALU_TYPE_PPS_NUT)
+		h265_pps_clear(ps);
+	free(ps);
+	if (bs == &nalu_bs)
+		h265_bs_clear(bs);
+	return res;
+}
+
+int h265_ctx_set_slice_header(struct h265_ctx *ctx,
+			      const struct h265_slice_header *sh)
+{
+	ULOG_ERRNO_RETURN_ERR_IF(ctx == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(sh == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(sh->num_entry_point_offsets > 0 &&
+					 sh->entry_point_offset_minus1 == NULL,
+				 EINVAL);
+
+	uint32_t *entry_points =
+		h265_ctx_alloc_entry_points(ctx, sh->num_entry_point_offsets);
+	if (entry_points == NULL)
+		return -ENOMEM;
+
+	ctx->slice_header = *sh;
+	ctx->slice_header.entry_point_offset_minus1 = entry_points;
+	if (sh->num_entry_point_offsets > 0)
+		memcpy(entry_points,
+		       sh->entry_point_offset_minus1,
+		       sizeof(*entry_points) * sh->num_entry_point_offsets);
+
+	return 0;
+}
+
+
+const struct h265_slice_header *
+h265_ctx_get_slice_header(struct h265_ctx *ctx)
+{
+	return ctx == NULL ? NULL : &ctx->slice_header;
+}
+
+
+static enum h265_pic_class h265_pic_class_from_type(uint32_t type)
+{
+	if (type <= H265_NALU_TYPE_STSA_R)
+		return H265_PIC_CLASS_TRAILING;
+	else if (type <= H265_NALU_TYPE_RADL_R)
+		return H265_PIC_CLASS_RADL;
+	else if (type <= H265_NALU_TYPE_RASL_R)
+		return H265_PIC_CLASS_RASL;
+	else if (type >= H265_NALU_TYPE_BLA_W_LP &&
+		 type <= H265_NALU_TYPE_RSV_IRAP_VCL23)
+		return H265_PIC_CLASS_IRAP;
+	else
+		return H265_PIC_CLASS_UNKNOWN;
+}
+
+
+/* 8.3.1 Decoding process for picture order count */
+static void h265_ctx_derive_poc(struct h265_ctx *ctx,
+				const struct h265_slice_header *sh)
+{
+	struct h265_au_info *info = &ctx->au_info;
+	uint32_t type = info->nal_unit_type;
+	uint32_t max_lsb = UINT32_C(1)
+			   << (ctx->sps->log2_max_pic_order_cnt_lsb_minus4 + 4);
+	uint32_t lsb = sh->slice_pic_order_cnt_lsb;
+	int32_t msb;
+
+	if (info->pic_class == H265_PIC_CLASS_IRAP) {
+		/* 8.1.3: IDR and BLA pictures, and CRA pictures starting a
+		 * coded video sequence (HandleCraAsBlaFlag is 0) */
+		ctx->no_rasl_output_flag = type < H265_NALU_TYPE_CRA_NUT ||
+					   !ctx->cvs_started;
+		ctx->cvs_started = 1;
+	} else if (!ctx->cvs_started) {
+		/* The POC of prevTid0Pic is not known */
+		return;
+	}
+
+	if (info->pic_class == H265_PIC_CLASS_IRAP &&
+	    ctx->no_rasl_output_flag) {
+		msb = 0;
+	} else {
+		uint32_t prev_lsb =
+			(uint32_t)ctx->prev_tid0_poc & (max_lsb - 1);
+		int32_t prev_msb = ctx->prev_tid0_poc - (int32_t)prev_lsb;
+
+		if (lsb < prev_lsb && prev_lsb - lsb >= max_lsb / 2)
+			msb = prev_msb + (int32_t)max_lsb;
+		else if (lsb > prev_lsb && lsb - prev_lsb > max_lsb / 2)
+			msb = prev_msb - (int32_t)max_lsb;
+		else
+			msb = prev_msb;
+	}
+
+	info->poc_valid = 1;
+	info->poc = msb + (int32_t)lsb;
+	info->no_rasl_output_flag = ctx->no_rasl_output_flag;
+	info->pic_output_flag =
+		(info->pic_class == H265_PIC_CLASS_RASL &&
+		 ctx->no_rasl_output_flag)
+			? 0
+			: sh->pic_output_flag;
+
+	/* prevTid0Pic: TemporalId equal to 0, and not a RASL, RADL or
+	 * sub-layer non-reference picture */
+	if (info->temporal_id == 0 &&
+	    info->pic_class != H265_PIC_CLASS_RADL &&
+	    info->pic_class != H265_PIC_CLASS_RASL &&
+	    !(type <= H265_NALU_TYPE_RSV_VCL_R15 && type % 2 == 0))
+		ctx->prev_tid0_poc = info->poc;
+}
+
+
+void h265_ctx_update_au_info(struct h265_ctx *ctx,
+			     const struct h265_ctx_cbs *cbs,
+			     void *userdata,
+			     int first_vcl,
+			     const struct h265_slice_header *sh)
+{
+	const struct h265_nalu_header *nh = &ctx->nalu_header;
+	struct h265_au_info *info = &ctx->au_info;
+
+	if (nh->nuh_layer_id != 0)
+		return;
+
+	if (nh->nal_unit_type == H265_NALU_TYPE_EOS_NUT ||
+	    nh->nal_unit_type == H265_NALU_TYPE_EOB_NUT) {
+		/* 8.1.3: the next picture starts a coded video sequence; the
+		 * pictures of this one are output now instead of being
+		 * discarded by a following CRA picture */
+		ctx->cvs_started = 0;
+		h265_dpb_flush(ctx, cbs, userdata);
+		return;
+	}
+
+	if (first_vcl) {
+		memset(info, 0, sizeof(*info));
+		info->nal_unit_type = nh->nal_unit_type;
+		info->pic_class = h265_pic_class_from_type(nh->nal_unit_type);
+		info->temporal_id = nh->nuh_temporal_id_plus1 - 1;
+		info->slice_type = H265_SLICE_TYPE_I;
+		info->pic_output_flag = 1;
+		info->decode_index = ctx->decode_count++;
+		if (sh != NULL)
+			h265_ctx_derive_poc(ctx, sh);
+		else if (info->pic_class != H265_PIC_CLASS_RASL &&
+			 info->pic_class != H265_PIC_CLASS_RADL)
+			/* The picture may be prevTid0Pic: the POC of the
+			 * next pictures is not known until an IRAP picture */
+			ctx->cvs_started = 0;
+
+		/* Without POC, the picture cannot be placed in the output
+		 * order: the pending pictures are output before the DPB
+		 * model restarts */
+		if (info->poc_valid)
+			h265_dpb_process(ctx, cbs, userdata, sh);
+		else
+			h265_dpb_flush(ctx, cbs, userdata);
+	}
+
+	/* slice_type values are ordered B < P < I */
+	if (sh != NULL && sh->slice_type < info->slice_type)
+		info->slice_type = sh->slice_type;
+}
+
+
+int h265_ctx_get_au_info(struct h265_ctx *ctx, struct h265_au_info *info)
+{
+	ULOG_ERRNO_RETURN_ERR_IF(ctx == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(info == NULL, EINVAL);
+
+	*info = ctx->au_info;
+
+	return 0;
+}
+
+
+int h265_ctx_dpb_flush(struct h265_ctx *ctx,
+		       const struct h265_ctx_cbs *cbs,
+		       void *userdata)
+{
+	ULOG_ERRNO_RETURN_ERR_IF(ctx == NULL, EINVAL);
+
+	h265_dpb_flush(ctx, cbs, userdata);
+
+	return 0;
+}
+
+
 const struct h265_vps *h265_ctx_get_vps(struct h265_ctx *ctx)
 {
 	return ctx == NULL ? NULL : ctx->vps;
@@ -300,11 +1059,16 @@ int h265_ctx_add_sei_internal(struct h265_ctx *ctx, struct h265_sei **ret_obj)
 	ULOG_ERRNO_RETURN_ERR_IF(ctx == NULL, EINVAL);
 
 	/* Increase table size */
-	newtable = realloc(ctx->sei_table,
-			   (ctx->sei_count + 1) * sizeof(*newtable));
-	if (newtable == NULL)
-		return -ENOMEM;
-	ctx->sei_table = newtable;
+	if (ctx->sei_count == ctx->sei_table_size) {
+		uint32_t size = ctx->sei_table_size == 0
+					? H265_SEI_TABLE_MIN_SIZE
+					: 2 * ctx->sei_table_size;
+		newtable = realloc(ctx->sei_table, size * sizeof(*newtable));
+		if (newtable == NULL)
+			return -ENOMEM;
+		ctx->sei_table = newtable;
+		ctx->sei_table_size = size;
+	}
 
 	/* Setup SEI pointer */
 	sei = &ctx->sei_table[ctx->sei_count];
@@ -338,10 +1102,18 @@ int h265_ctx_add_sei(struct h265_ctx *ctx, const struct h265_sei *sei)
 	if (res < 0)
 		goto error;
 
-	/* Acquire buffer of bitstream */
-	res = h265_bs_acquire_buf(&bs, &new_sei->raw.buf, &new_sei->raw.len);
-	if (res < 0)
+	/* Copy the payload in the SEI arena */
+	if (!h265_bs_byte_aligned(&bs)) {
+		res = -EIO;
+		goto error;
+	}
+	new_sei->raw.buf = h265_ctx_sei_alloc(ctx, bs.off);
+	if (new_sei->raw.buf == NULL) {
+		res = -ENOMEM;
 		goto error;
+	}
+	memcpy(new_sei->raw.buf, bs.data, bs.off);
+	new_sei->raw.len = bs.off;
 
 	/* Update internal buffer of SEI structures */
 	res = h265_sei_update_internal_buf(new_sei);
@@ -352,10 +1124,8 @@ int h265_ctx_add_sei(struct h265_ctx *ctx, const struct h265_sei *sei)
 	return 0;
 
 error:
-	if (new_sei != NULL) {
-		free(new_sei->raw.buf);
+	if (new_sei != NULL)
 		ctx->sei_count--;
-	}
 	h265_bs_clear(&bs);
 	return res;
 }
@@ -0,0 +1,261 @@
+/**
+ * Copyright (c) 2019 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Drones SAS Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT DRONES SAS COMPANY BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "h265_priv.h"
+
+
+/* Remove the pictures not needed for output and unused for reference */
+static void h265_dpb_remove_unused(struct h265_ctx *ctx)
+{
+	uint32_t n = 0;
+
+	for (uint32_t i = 0; i < ctx->dpb_count; i++) {
+		if (!ctx->dpb[i].needed_for_output &&
+		    !ctx->dpb[i].used_for_reference)
+			continue;
+		ctx->dpb[n++] = ctx->dpb[i];
+	}
+	ctx->dpb_count = n;
+}
+
+
+/* C.5.2.4 "Bumping" process: output of the picture with the smallest POC
+ * among the ones needed for output */
+static int h265_dpb_bump(struct h265_ctx *ctx,
+			 const struct h265_ctx_cbs *cbs,
+			 void *userdata,
+			 int flush)
+{
+	struct h265_dpb_pic *pic = NULL;
+	struct h265_dpb_output output;
+
+	for (uint32_t i = 0; i < ctx->dpb_count; i++) {
+		if (ctx->dpb[i].needed_for_output &&
+		    (pic == NULL || ctx->dpb[i].poc < pic->poc))
+			pic = &ctx->dpb[i];
+	}
+	if (pic == NULL)
+		return 0;
+
+	pic->needed_for_output = 0;
+
+	if (cbs != NULL && cbs->dpb_output != NULL) {
+		output.poc = pic->poc;
+		output.decode_index = pic->decode_index;
+		output.output_index = ctx->au_info.decode_index;
+		output.latency = output.output_index - output.decode_index;
+		output.flush = flush;
+		(*cbs->dpb_output)(ctx, &output, userdata);
+	}
+
+	if (!pic->used_for_reference)
+		h265_dpb_remove_unused(ctx);
+
+	return 1;
+}
+
+
+/* Whether the bumping process is needed because of the number of pictures
+ * waiting for output or of their latency (C.5.2.2 and C.5.2.3) */
+static int h265_dpb_output_needed(struct h265_ctx *ctx,
+				  const struct h265_sps *sps)
+{
+	uint32_t htid = sps->sps_max_sub_layers_minus1;
+	uint32_t num_reorder = sps->sps_max_num_reorder_pics[htid];
+	uint32_t latency_plus1 = sps->sps_max_latency_increase_plus1[htid];
+	/* SpsMaxLatencyPictures (7-9) */
+	uint64_t max_latency = (uint64_t)num_reorder + latency_plus1 - 1;
+	uint32_t num_output = 0;
+	int latency_reached = 0;
+
+	for (uint32_t i = 0; i < ctx->dpb_count; i++) {
+		if (!ctx->dpb[i].needed_for_output)
+			continue;
+		num_output++;
+		if (latency_plus1 != 0 &&
+		    ctx->dpb[i].latency_count >= max_latency)
+			latency_reached = 1;
+	}
+
+	return num_output > num_reorder || latency_reached;
+}
+
+
+/* 8.3.2: the pictures not included in the RPS of the current picture are
+ * marked as unused for reference */
+static void h265_dpb_mark_rps(struct h265_ctx *ctx,
+			      const struct h265_sps *sps,
+			      const struct h265_slice_header *sh)
+{
+	const struct h265_st_ref_pic_set *st_rps;
+	int32_t poc = ctx->au_info.poc;
+	uint32_t max_lsb = UINT32_C(1)
+			   << (sps->log2_max_pic_order_cnt_lsb_minus4 + 4);
+
+	st_rps = sh->short_term_ref_pic_set_sps_flag
+			 ? &sps->st_ref_pic_sets[sh->short_term_ref_pic_set_idx]
+			 : &sh->st_ref_pic_set;
+
+	for (uint32_t i = 0; i < ctx->dpb_count; i++) {
+		struct h265_dpb_pic *pic = &ctx->dpb[i];
+		uint32_t delta_poc_msb_cycle_lt = 0;
+		int used = 0;
+
+		for (uint32_t j = 0; j < st_rps->num_negative_pics; j++) {
+			if (pic->poc == poc + st_rps->derived_delta_poc_s0[j])
+				used = 1;
+		}
+		for (uint32_t j = 0; j < st_rps->num_positive_pics; j++) {
+			if (pic->poc == poc + st_rps->derived_delta_poc_s1[j])
+				used = 1;
+		}
+
+		for (uint32_t j = 0;
+		     j < sh->num_long_term_sps + sh->num_long_term_pics;
+		     j++) {
+			uint32_t lsb_lt =
+				(j < sh->num_long_term_sps)
+					? sps->lt_ref_pic_poc_lsb_sps
+						  [sh->lt_idx_sps[j]]
+					: sh->poc_lsb_lt[j];
+
+			/* DeltaPocMsbCycleLt (7-52) */
+			if (j == 0 || j == sh->num_long_term_sps)
+				delta_poc_msb_cycle_lt = 0;
+			delta_poc_msb_cycle_lt += sh->delta_poc_msb_cycle_lt[j];
+
+			if (!sh->delta_poc_msb_present_flag[j]) {
+				if (((uint32_t)pic->poc & (max_lsb - 1)) ==
+				    lsb_lt)
+					used = 1;
+				continue;
+			}
+
+			/* 8.3.2: PocLtCurr or PocLtFoll with the MSB */
+			int32_t poc_lt =
+				poc - (int32_t)sh->slice_pic_order_cnt_lsb +
+				(int32_t)lsb_lt -
+				(int32_t)(delta_poc_msb_cycle_lt * max_lsb);
+			if (pic->poc == poc_lt)
+				used = 1;
+		}
+
+		pic->used_for_reference = used;
+	}
+}
+
+
+void h265_dpb_process(struct h265_ctx *ctx,
+		      const struct h265_ctx_cbs *cbs,
+		      void *userdata,
+		      const struct h265_slice_header *sh)
+{
+	const struct h265_sps *sps = ctx->sps;
+	struct h265_au_info *info = &ctx->au_info;
+	uint32_t htid = sps->sps_max_sub_layers_minus1;
+	uint32_t dpb_size = sps->sps_max_dec_pic_buffering_minus1[htid] + 1;
+	struct h265_dpb_pic *pic;
+
+	if (dpb_size > H265_DPB_SIZE_MAX)
+		dpb_size = H265_DPB_SIZE_MAX;
+
+	/* C.5.2.2 Output and removal of pictures from the DPB */
+	if (info->pic_class == H265_PIC_CLASS_IRAP &&
+	    info->no_rasl_output_flag) {
+		/* NoOutputOfPriorPicsFlag is 1 for a CRA picture, the prior
+		 * pictures are then discarded */
+		if (info->nal_unit_type == H265_NALU_TYPE_CRA_NUT ||
+		    sh->no_output_of_prior_pics_flag) {
+			h265_dpb_clear(ctx);
+		} else {
+			for (uint32_t i = 0; i < ctx->dpb_count; i++)
+				ctx->dpb[i].used_for_reference = 0;
+			h265_dpb_remove_unused(ctx);
+			while (h265_dpb_bump(ctx, cbs, userdata, 1))
+				;
+		}
+	} else {
+		h265_dpb_mark_rps(ctx, sps, sh);
+		h265_dpb_remove_unused(ctx);
+		while (h265_dpb_output_needed(ctx, sps) ||
+		       ctx->dpb_count >= dpb_size) {
+			if (!h265_dpb_bump(ctx, cbs, userdata, 0))
+				break;
+		}
+	}
+
+	/* Non-conforming stream: the DPB is full of reference pictures not
+	 * needed for output, the oldest one is dropped */
+	if (ctx->dpb_count == H265_DPB_SIZE_MAX) {
+		ULOGW("DPB full, dropping picture with POC %d",
+		      ctx->dpb[0].poc);
+		ctx->dpb[0].used_for_reference = 0;
+		ctx->dpb[0].needed_for_output = 0;
+		h265_dpb_remove_unused(ctx);
+	}
+
+	/* C.5.2.3 Picture decoding, marking, additional bumping and
+	 * storage */
+	if (info->pic_output_flag) {
+		for (uint32_t i = 0; i < ctx->dpb_count; i++) {
+			if (ctx->dpb[i].needed_for_output &&
+			    ctx->dpb[i].poc > info->poc)
+				ctx->dpb[i].latency_count++;
+		}
+	}
+
+	pic = &ctx->dpb[ctx->dpb_count++];
+	pic->poc = info->poc;
+	pic->decode_index = info->decode_index;
+	pic->latency_count = 0;
+	pic->needed_for_output = info->pic_output_flag;
+	pic->used_for_reference = 1;
+
+	while (h265_dpb_output_needed(ctx, sps)) {
+		if (!h265_dpb_bump(ctx, cbs, userdata, 0))
+			break;
+	}
+
+	info->dpb_fullness = ctx->dpb_count;
+}
+
+
+void h265_dpb_flush(struct h265_ctx *ctx,
+		    const struct h265_ctx_cbs *cbs,
+		    void *userdata)
+{
+	/* C.5.2.2: all the pictures needed for output are output by
+	 * repeatedly invoking the "bumping" process */
+	while (h265_dpb_bump(ctx, cbs, userdata, 1))
+		;
+	h265_dpb_clear(ctx);
+}
+
+
+void h265_dpb_clear(struct h265_ctx *ctx)
+{
+	ctx->dpb_count = 0;
+}
@@ -61,6 +61,7 @@ struct h265_dump {
 #define H265_BITS_I(_f, _n) H265_DUMP_BITS_I(_f, _n)
 #define H265_BITS_UE(_f) H265_DUMP_BITS_UE(_f)
 #define H265_BITS_SE(_f) H265_DUMP_BITS_SE(_f)
+#define H265_BYTES(_f, _n) H265_DUMP_BYTES(_f, _n)
 #define H265_BITS_TE(_f, _m) H265_DUMP_BITS_TE(_f, _m)
 
 /* clang-format off */
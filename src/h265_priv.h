@@ -52,6 +52,72 @@
 #define ARRAY_SIZE(x) (sizeof(x) / sizeof((x)[0]))
 
 
+/* Number of leading zero bits of a non-zero 64-bit value */
+static inline uint32_t h265_clz64(uint64_t v)
+{
+#if defined(__GNUC__)
+	return __builtin_clzll(v);
+#else
+	uint32_t n = 0;
+	while ((v & (UINT64_C(1) << 63)) == 0) {
+		v <<= 1;
+		n++;
+	}
+	return n;
+#endif
+}
+
+
+/* Ceil(Log2(v)) */
+static inline uint32_t h265_ceil_log2(uint64_t v)
+{
+	uint32_t n = 0;
+	while ((UINT64_C(1) << n) < v)
+		n++;
+	return n;
+}
+
+
+/* Raw bytes of a stored parameter set NAL unit, to detect repetitions */
+struct h265_ps_raw {
+	uint8_t *buf;
+	size_t len;
+	uint32_t hash;
+
+	/* Reader flags affecting the parsed structure */
+	uint32_t flags;
+};
+
+
+/* Raw bytes produced by the writer (see h265_hvcc_build()): they are kept so
+ * that the parameter set is not serialized again, but never match a received
+ * NAL unit in h265_ctx_reuse_ps() */
+#define H265_PS_RAW_FLAGS_WRITTEN (1u << 31)
+
+
+/* Block of a memory arena, see h265_ctx_sei_alloc() */
+struct h265_arena_block {
+	struct h265_arena_block *next;
+	size_t size;
+	size_t used;
+	uint8_t data[];
+};
+
+
+/* MaxDpbSize is at most 16 (A.4.2) */
+#define H265_DPB_SIZE_MAX 16
+
+
+/* Picture storage buffer of the DPB model, see h265_dpb_process() */
+struct h265_dpb_pic {
+	int32_t poc;
+	uint64_t decode_index;
+	uint32_t latency_count;
+	int needed_for_output;
+	int used_for_reference;
+};
+
+
 struct h265_ctx {
 	struct h265_nalu_header nalu_header;
 
@@ -70,11 +136,58 @@ struct h265_ctx {
 	struct h265_pps *pps;
 	struct h265_pps *pps_table[64];
 
+	struct h265_ps_raw vps_raw[16];
+	struct h265_ps_raw sps_raw[16];
+	struct h265_ps_raw pps_raw[64];
+	int ps_unchanged;
+
+	/* SEI messages of the current NAL unit; the table and the arena
+	 * holding the payloads are kept between NAL units */
 	struct h265_sei *sei_table;
 	uint32_t sei_count;
+	uint32_t sei_table_size;
+	struct h265_arena_block *sei_arena;
+
+	/* Slice segment header of the current NAL unit; the fields not
+	 * present in a dependent slice segment are kept from the preceding
+	 * independent slice segment */
+	struct h265_slice_header slice_header;
+	uint32_t *entry_points;
+	size_t entry_points_size;
+
+	/* Access unit info of the current picture, and picture order count
+	 * derivation state (8.3.1): whether an IRAP picture has started the
+	 * current coded video sequence, NoRaslOutputFlag of the associated
+	 * IRAP picture and PicOrderCntVal of prevTid0Pic */
+	struct h265_au_info au_info;
+	int cvs_started;
+	int no_rasl_output_flag;
+	int32_t prev_tid0_poc;
+	uint64_t decode_count;
+
+	/* Output order DPB model (C.5.2) */
+	struct h265_dpb_pic dpb[H265_DPB_SIZE_MAX];
+	uint32_t dpb_count;
 };
 
 
+/**
+ * Selective parsing: whether only the header of a NAL unit is parsed,
+ * according to the reader flags (H265_READER_FLAGS_NALU_ONLY and
+ * H265_READER_FLAGS_PS_ONLY).
+ */
+static inline int h265_reader_nalu_header_only(uint32_t flags,
+					       enum h265_nalu_type type)
+{
+	if (flags & H265_READER_FLAGS_NALU_ONLY)
+		return 1;
+	return (flags & H265_READER_FLAGS_PS_ONLY) &&
+	       type != H265_NALU_TYPE_VPS_NUT &&
+	       type != H265_NALU_TYPE_SPS_NUT &&
+	       type != H265_NALU_TYPE_PPS_NUT;
+}
+
+
 int h265_get_info_from_ps(const struct h265_vps *vps,
 			  const struct h265_sps *sps,
 			  const struct h265_pps *pps,
@@ -84,9 +197,153 @@ int h265_get_info_from_ps(const struct h265_vps *vps,
 static int h265_ctx_clear_sei_table(struct h265_ctx *ctx);
 
 
+/**
+ * Reuse a stored parameter set if the given NAL unit is byte-identical to
+ * the one it was parsed from (with the same reader flags); the current
+ * VPS, SPS or PPS of the context is then set to the stored structure.
+ *
+ * @return 1 if the parameter set is reused, 0 otherwise
+ */
+int h265_ctx_reuse_ps(struct h265_ctx *ctx,
+		      enum h265_nalu_type type,
+		      const uint8_t *buf,
+		      size_t len,
+		      uint32_t flags);
+
+
+/**
+ * Remember the NAL unit the current VPS, SPS or PPS of the context was just
+ * parsed from, see h265_ctx_reuse_ps().
+ */
+int h265_ctx_set_ps_raw(struct h265_ctx *ctx,
+			enum h265_nalu_type type,
+			const uint8_t *buf,
+			size_t len,
+			uint32_t flags);
+
+
+/**
+ * Parse a VPS, SPS or PPS NAL unit and store it in the context: it becomes
+ * the current one and the NAL unit is remembered, see h265_ctx_set_ps_raw().
+ *
+ * @param bs RBSP of the NAL unit after its header, or NULL to parse buf
+ * from its header
+ * @param buf,len NAL unit
+ * @param flags Reader flags the parameter set is parsed with
+ * @param changes Optional H265_PS_CHANGED_* bits against the stored
+ * parameter set with the same id, see h265_ctx_get_ps_changes()
+ *
+ * @return 0 on success, negative errno value in case of error
+ */
+int h265_ctx_set_ps_from_nalu(struct h265_ctx *ctx,
+			      struct h265_bitstream *bs,
+			      enum h265_nalu_type type,
+			      const uint8_t *buf,
+			      size_t len,
+			      uint32_t flags,
+			      uint32_t *changes);
+
+
+/**
+ * Parse the RBSP of a VPS, SPS or PPS (ps is a struct h265_vps, h265_sps or
+ * h265_pps depending on type), checking for the end of the stream once.
+ */
+int h265_read_ps(struct h265_bitstream *bs, enum h265_nalu_type type, void *ps);
+
+
+/**
+ * Compare a new VPS, SPS or PPS with the stored one with the same id.
+ *
+ * @return H265_PS_CHANGED_* bits, 0 if the parameter sets are identical
+ */
+uint32_t h265_ctx_get_ps_changes(struct h265_ctx *ctx,
+				 enum h265_nalu_type type,
+				 const void *ps);
+
+
+/**
+ * Call the ps_changed callback if changes is not 0.
+ */
+void h265_ctx_ps_changed(struct h265_ctx *ctx,
+			 const struct h265_ctx_cbs *cbs,
+			 void *userdata,
+			 enum h265_nalu_type type,
+			 uint32_t changes);
+
+
 int h265_ctx_add_sei_internal(struct h265_ctx *ctx, struct h265_sei **ret_obj);
 
 
+/**
+ * Allocate memory for the SEI messages of the current NAL unit. The memory
+ * is only valid until the next h265_ctx_clear_nalu() call and must not be
+ * freed.
+ *
+ * @return Pointer to the allocated memory, or NULL on allocation failure
+ */
+void *h265_ctx_sei_alloc(struct h265_ctx *ctx, size_t size);
+
+
+/**
+ * Get storage for the entry points of the current slice segment header (see
+ * entry_point_offset_minus1 in struct h265_slice_header). The storage is
+ * kept between NAL units.
+ *
+ * @return Pointer to an array of count elements, or NULL on allocation
+ * failure
+ */
+uint32_t *h265_ctx_alloc_entry_points(struct h265_ctx *ctx, uint32_t count);
+
+
+/**
+ * Update the access unit info and the picture order count derivation state
+ * with the current NAL unit, once the end of the previous access unit has
+ * been signaled.
+ *
+ * @param ctx Context handle
+ * @param cbs,userdata Callbacks
+ * @param first_vcl 1 if the NAL unit is the first slice segment of a
+ * picture, 0 otherwise
+ * @param sh Slice segment header of the NAL unit, NULL if it has not been
+ * parsed or if the NAL unit is not a slice segment
+ */
+void h265_ctx_update_au_info(struct h265_ctx *ctx,
+			     const struct h265_ctx_cbs *cbs,
+			     void *userdata,
+			     int first_vcl,
+			     const struct h265_slice_header *sh);
+
+
+/**
+ * Run the output order operation of the DPB (C.5.2.2 and C.5.2.3) for the
+ * current picture, whose info is ctx->au_info, calling the dpb_output
+ * callback for each picture output.
+ *
+ * @param ctx Context handle
+ * @param cbs,userdata Callbacks
+ * @param sh Slice segment header of the first slice segment of the picture
+ */
+void h265_dpb_process(struct h265_ctx *ctx,
+		      const struct h265_ctx_cbs *cbs,
+		      void *userdata,
+		      const struct h265_slice_header *sh);
+
+
+/**
+ * Output all the pictures of the DPB model waiting for output, in POC order
+ * (with the flush flag of the dpb_output callback set), then empty it.
+ */
+void h265_dpb_flush(struct h265_ctx *ctx,
+		    const struct h265_ctx_cbs *cbs,
+		    void *userdata);
+
+
+/**
+ * Empty the DPB model without output.
+ */
+void h265_dpb_clear(struct h265_ctx *ctx);
+
+
 int h265_write_one_sei(struct h265_bitstream *bs,
 		       struct h265_ctx *ctx,
 		       const struct h265_sei *sei);
@@ -95,4 +352,68 @@ int h265_write_one_sei(struct h265_bitstream *bs,
 int h265_sei_update_internal_buf(struct h265_sei *sei);
 
 
+/**
+ * Find the first start code in a buffer.
+ *
+ * @param buf,len Buffer to scan
+ * @param start Offset of the first byte of the start code
+ * @param end Offset of the first byte following the start code
+ *
+ * @return 0 on success, -ENOENT if there is no start code in the buffer
+ */
+int h265_find_start_code(const uint8_t *buf,
+			 size_t len,
+			 size_t *start,
+			 size_t *end);
+
+
+/**
+ * Result of the parsing of a structure with unchecked reads: -EIO if a read
+ * went past the end of the stream, see h265_bs_overread().
+ */
+static inline int h265_bs_read_end(const struct h265_bitstream *bs, int res)
+{
+	return (res >= 0 && h265_bs_overread(bs)) ? -EIO : res;
+}
+
+
+/**
+ * Skip bytes in a byte-aligned stream being read.
+ *
+ * @return 0 on success, -EIO if the end of stream is reached
+ */
+int h265_bs_skip_bytes(struct h265_bitstream *bs, size_t len);
+
+
+/**
+ * Write bytes to a byte-aligned stream, inserting emulation prevention
+ * bytes in a single pass.
+ */
+int h265_bs_write_escaped(struct h265_bitstream *bs,
+			  const uint8_t *buf,
+			  size_t len);
+
+
+/**
+ * Find the first pair of consecutive zero bytes in a buffer.
+ *
+ * @param buf,len Buffer to scan
+ *
+ * @return Offset of the first byte of the pair, or len if there is none
+ */
+size_t h265_scan_zero_pair(const uint8_t *buf, size_t len);
+
+
+/**
+ * Find the first start code candidate in a buffer, i.e. the first
+ * 00 00 0x sequence with x equal to 0x00 or 0x01 (see B.2: both start codes
+ * and the end of a NAL unit begin with such a sequence).
+ *
+ * @param buf,len Buffer to scan
+ *
+ * @return Offset of the first byte of the sequence, or len if there is none
+ */
+size_t h265_scan_start_code(const uint8_t *buf, size_t len);
+
+
 #endif /* !_H265_PRIV_H_ */
@@ -33,17 +33,57 @@ struct h265_reader {
 	int stop;
 	struct h265_ctx *ctx;
 	uint32_t flags;
+
+	/* Current NAL unit, as given by the caller */
+	const uint8_t *nalu_buf;
+	size_t nalu_len;
+
+	/* RBSP scratch buffer (followed by H265_BS_PADDING zero bytes) */
+	uint8_t *rbsp_buf;
+	size_t rbsp_size;
+	size_t rbsp_len;
+
+	/* Offsets in the NAL unit of the emulation prevention bytes removed
+	 * in the RBSP */
+	size_t *ep_pos;
+	size_t ep_size;
+	size_t ep_count;
+
+	/* Streaming state (H265_READER_FLAGS_STREAM) */
+	struct {
+		/* Flags of the last call */
+		uint32_t flags;
+
+		/* The end of the current NAL unit has not been found yet */
+		int in_nalu;
+
+		/* Trailing zero bytes of the last buffer outside of a NAL unit
+		 * (possible beginning of a start code) */
+		size_t zeros;
+
+		/* Copy of the incomplete NAL unit */
+		uint8_t *buf;
+		size_t len;
+		size_t size;
+
+		/* Incomplete data kept by the caller (no copy mode) */
+		const uint8_t *kept;
+		size_t kept_len;
+	} stream;
 };
 
 
 #define H265_SYNTAX_OP_NAME read
 #define H265_SYNTAX_OP_KIND H265_SYNTAX_OP_KIND_READ
 
-#define H265_BITS(_f, _n) H265_READ_BITS(_f, _n)
-#define H265_BITS_U(_f, _n) H265_READ_BITS_U(_f, _n)
-#define H265_BITS_I(_f, _n) H265_READ_BITS_I(_f, _n)
-#define H265_BITS_UE(_f) H265_READ_BITS_UE(_f)
-#define H265_BITS_SE(_f) H265_READ_BITS_SE(_f)
+/* Fields are read unchecked, the end of stream is checked once per structure
+ * (see H265_END() in the syntax) */
+#define H265_BITS(_f, _n) H265_READ_BITS_UNCHECKED(_f, _n)
+#define H265_BITS_U(_f, _n) H265_READ_BITS_U_UNCHECKED(_f, _n)
+#define H265_BITS_I(_f, _n) H265_READ_BITS_I_UNCHECKED(_f, _n)
+#define H265_BITS_UE(_f) H265_READ_BITS_UE_UNCHECKED(_f)
+#define H265_BITS_SE(_f) H265_READ_BITS_SE_UNCHECKED(_f)
+#define H265_BYTES(_f, _n) H265_READ_BYTES(_f, _n)
 
 #define H265_BITS_RBSP_TRAILING()                                              \
 	do {                                                                   \
@@ -51,6 +91,39 @@ struct h265_reader {
 		ULOG_ERRNO_RETURN_ERR_IF(_res < 0, -_res);                     \
 	} while (0)
 
+/**
+ * Get the location in the NAL unit given by the caller of a range of its RBSP,
+ * if the range contains no emulation prevention byte.
+ *
+ * @return Pointer to the range in the NAL unit, or NULL if the range is not
+ * contiguous in the NAL unit (or is not in the RBSP)
+ */
+static const uint8_t *h265_reader_nalu_view(struct h265_reader *reader,
+					    const uint8_t *rbsp,
+					    size_t len)
+{
+	size_t off, n = 0;
+
+	if (rbsp < reader->rbsp_buf ||
+	    rbsp + len > reader->rbsp_buf + reader->rbsp_len)
+		return NULL;
+	off = rbsp - reader->rbsp_buf;
+
+	for (size_t i = 0; i < reader->ep_count; i++) {
+		/* Offset in the RBSP of the byte following the escape byte */
+		size_t pos = reader->ep_pos[i] - i;
+		if (pos <= off)
+			n++;
+		else if (pos < off + len)
+			return NULL;
+		else
+			break;
+	}
+
+	return reader->nalu_buf + off + n;
+}
+
+
 #include "h265_syntax.h"
 
 
@@ -100,6 +173,9 @@ int h265_reader_destroy(struct h265_reader *reader)
 		return 0;
 
 	int res = h265_ctx_destroy(reader->ctx);
+	free(reader->rbsp_buf);
+	free(reader->ep_pos);
+	free(reader->stream.buf);
 	free(reader);
 	return res;
 }
@@ -118,6 +194,205 @@ struct h265_ctx *h265_reader_get_ctx(struct h265_reader *reader)
 }
 
 
+static int h265_reader_stream_append(struct h265_reader *reader,
+				     const uint8_t *buf,
+				     size_t len)
+{
+	/* The copy is followed by H265_BS_PADDING zero bytes, see
+	 * h265_bs_cinit_padded() */
+	size_t size = reader->stream.len + len + H265_BS_PADDING;
+
+	if (size > reader->stream.size) {
+		/* Wanted capacity round up, grow geometrically */
+		if (size < 2 * reader->stream.size)
+			size = 2 * reader->stream.size;
+		size = (size + 4095) & ~(size_t)4095;
+		uint8_t *newbuf = realloc(reader->stream.buf, size);
+		if (newbuf == NULL)
+			return -ENOMEM;
+		reader->stream.buf = newbuf;
+		reader->stream.size = size;
+	}
+
+	memcpy(reader->stream.buf + reader->stream.len, buf, len);
+	reader->stream.len += len;
+	memset(reader->stream.buf + reader->stream.len, 0, H265_BS_PADDING);
+	return 0;
+}
+
+
+static size_t h265_trailing_zeros(const uint8_t *buf, size_t len, size_t max)
+{
+	size_t n = 0;
+	while (n < len && n < max && buf[len - 1 - n] == 0x00)
+		n++;
+	return n;
+}
+
+
+/**
+ * Resolve the data straddling the previous buffer and the new one in the
+ * copy streaming mode: the end of the pending NAL unit, and a start code
+ * beginning in the trailing zero bytes of the previous buffer.
+ *
+ * On return, *i is the offset in buf where the regular scan resumes;
+ * returns 1 if all the data has been consumed.
+ */
+static int h265_reader_stream_resolve(struct h265_reader *reader,
+				      uint32_t flags,
+				      const uint8_t *buf,
+				      size_t len,
+				      size_t *i)
+{
+	int res = 0;
+	uint8_t tmp[8];
+	size_t n = 0, t = 0, j = 0, end = 0, start = 0;
+
+	*i = 0;
+
+	if (reader->stream.in_nalu && reader->stream.len > 0) {
+		/* Look for the end of the pending NAL unit beginning in its
+		 * last two bytes, then in the new data */
+		t = reader->stream.len < 2 ? reader->stream.len : 2;
+		n = t + (len < 2 ? len : 2);
+		memcpy(tmp, reader->stream.buf + reader->stream.len - t, t);
+		memcpy(tmp + t, buf, n - t);
+		j = h265_scan_start_code(tmp, n);
+		if (j < t) {
+			end = reader->stream.len - t + j;
+			reader->stream.zeros = reader->stream.len - end;
+		} else {
+			j = h265_scan_start_code(buf, len);
+			res = h265_reader_stream_append(reader, buf, j);
+			if (res < 0)
+				return res;
+			if (j == len)
+				return 1;
+			end = reader->stream.len;
+			*i = j;
+		}
+
+		h265_reader_parse_nalu(reader, flags, reader->stream.buf, end);
+		reader->stream.in_nalu = 0;
+		reader->stream.len = 0;
+		if (reader->stop)
+			return 0;
+	}
+
+	if (!reader->stream.in_nalu && reader->stream.zeros > 0) {
+		/* Look for a start code beginning in the trailing zero bytes
+		 * of the previous buffer; a start code found entirely in the
+		 * new data up to the same end gives the same NAL unit start */
+		t = reader->stream.zeros;
+		n = t + (len - *i < 3 ? len - *i : 3);
+		memset(tmp, 0, t);
+		memcpy(tmp + t, buf + *i, n - t);
+		res = h265_find_nalu(tmp, n, &start, &end);
+		reader->stream.zeros = 0;
+		if ((res == 0 || res == -EAGAIN) && start <= t + 3) {
+			reader->stream.in_nalu = 1;
+			*i += start - t;
+		} else if (n < t + 3) {
+			/* Not enough data to decide */
+			reader->stream.zeros = h265_trailing_zeros(tmp, n, 3);
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+
+/**
+ * Streaming variant of h265_reader_parse(), see H265_READER_FLAGS_STREAM
+ */
+static int h265_reader_parse_stream(struct h265_reader *reader,
+				    uint32_t flags,
+				    const uint8_t *buf,
+				    size_t len,
+				    size_t *off)
+{
+	int res = 0;
+	int nocopy = (flags & H265_READER_FLAGS_STREAM_NO_COPY) != 0;
+	size_t i = 0, sc = 0, start = 0, j = 0, resume = 0, n = 0;
+
+	reader->stream.flags = flags;
+
+	if (nocopy) {
+		/* The kept data is given again at the beginning of the buffer,
+		 * skip the part already scanned */
+		if (reader->stream.kept_len >= 2 &&
+		    len >= reader->stream.kept_len)
+			resume = reader->stream.kept_len - 2;
+		reader->stream.kept = NULL;
+		reader->stream.kept_len = 0;
+	} else {
+		res = h265_reader_stream_resolve(reader, flags, buf, len, &i);
+		if (res < 0)
+			return res;
+		if (res > 0) {
+			*off = len;
+			return 0;
+		}
+	}
+
+	while (!reader->stop) {
+		if (!reader->stream.in_nalu) {
+			res = h265_find_start_code(
+				buf + i, len - i, &sc, &start);
+			if (res < 0) {
+				/* No start code, but the trailing zero bytes
+				 * may begin one */
+				n = h265_trailing_zeros(buf + i, len - i, 3);
+				if (nocopy) {
+					reader->stream.kept = buf + len - n;
+					reader->stream.kept_len = n;
+					*off = len - n;
+				} else {
+					reader->stream.zeros = n;
+					*off = len;
+				}
+				return 0;
+			}
+			sc += i;
+			start += i;
+			reader->stream.in_nalu = 1;
+		} else {
+			/* NAL unit starting at the beginning of the data */
+			sc = start = i;
+		}
+
+		/* Search for the end of the NAL unit */
+		j = start > resume ? start : resume;
+		resume = 0;
+		j += h265_scan_start_code(buf + j, len - j);
+		if (j == len) {
+			/* Incomplete NAL unit */
+			if (nocopy) {
+				reader->stream.in_nalu = 0;
+				reader->stream.kept = buf + sc;
+				reader->stream.kept_len = len - sc;
+				*off = sc;
+			} else {
+				res = h265_reader_stream_append(
+					reader, buf + start, len - start);
+				if (res < 0)
+					return res;
+				*off = len;
+			}
+			return 0;
+		}
+
+		h265_reader_parse_nalu(reader, flags, buf + start, j - start);
+		reader->stream.in_nalu = 0;
+		i = j;
+	}
+
+	*off = i;
+	return 0;
+}
+
+
 int h265_reader_parse(struct h265_reader *reader,
 		      uint32_t flags,
 		      const uint8_t *buf,
@@ -135,6 +410,9 @@ int h265_reader_parse(struct h265_reader *reader,
 
 	reader->stop = 0;
 
+	if (flags & H265_READER_FLAGS_STREAM)
+		return h265_reader_parse_stream(reader, flags, buf, len, off);
+
 	while (*off < len && !reader->stop) {
 		res = h265_find_nalu(buf + *off, len - *off, &start, &end);
 		if (res < 0 && res != -EAGAIN)
@@ -150,12 +428,155 @@ int h265_reader_parse(struct h265_reader *reader,
 }
 
 
+int h265_reader_parse_length_prefixed(struct h265_reader *reader,
+				      uint32_t flags,
+				      const uint8_t *buf,
+				      size_t len,
+				      uint32_t length_size)
+{
+	size_t off = 0;
+	size_t nalu_len;
+
+	ULOG_ERRNO_RETURN_ERR_IF(reader == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(buf == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(length_size != 1 && length_size != 2 &&
+					 length_size != 4,
+				 EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(flags & H265_READER_FLAGS_STREAM, EINVAL);
+
+	reader->stop = 0;
+
+	while (off < len && !reader->stop) {
+		if (len - off < length_size) {
+			ULOGE("%s: truncated NALU length at offset %zu",
+			      __func__,
+			      off);
+			return -EPROTO;
+		}
+		nalu_len = 0;
+		for (uint32_t i = 0; i < length_size; i++)
+			nalu_len = (nalu_len << 8) | buf[off + i];
+		off += length_size;
+		if (nalu_len == 0 || nalu_len > len - off) {
+			ULOGE("%s: invalid NALU size (%zu) at offset %zu",
+			      __func__,
+			      nalu_len,
+			      off - length_size);
+			return -EPROTO;
+		}
+
+		/* The NAL units are parsed in place, without any copy of the
+		 * sample */
+		h265_reader_parse_nalu(reader, flags, buf + off, nalu_len);
+
+		off += nalu_len;
+	}
+
+	return 0;
+}
+
+
+int h265_reader_flush(struct h265_reader *reader)
+{
+	int res = 0;
+	size_t start = 0, end = 0;
+
+	ULOG_ERRNO_RETURN_ERR_IF(reader == NULL, EINVAL);
+
+	if (reader->stream.in_nalu && reader->stream.len > 0) {
+		res = h265_reader_parse_nalu(reader,
+					     reader->stream.flags,
+					     reader->stream.buf,
+					     reader->stream.len);
+	} else if (reader->stream.kept_len > 0 &&
+		   h265_find_nalu(reader->stream.kept,
+				  reader->stream.kept_len,
+				  &start,
+				  &end) == -EAGAIN &&
+		   end > start) {
+		res = h265_reader_parse_nalu(reader,
+					     reader->stream.flags,
+					     reader->stream.kept + start,
+					     end - start);
+	}
+
+	reader->stream.in_nalu = 0;
+	reader->stream.zeros = 0;
+	reader->stream.len = 0;
+	reader->stream.kept = NULL;
+	reader->stream.kept_len = 0;
+
+	/* End of the stream: output the pictures left in the DPB model */
+	h265_dpb_flush(reader->ctx, &reader->cbs, reader->userdata);
+
+	return res;
+}
+
+
+static int h265_reader_to_rbsp(struct h265_reader *reader,
+			       const uint8_t *buf,
+			       size_t len,
+			       size_t *rbsp_len)
+{
+	int res;
+
+	if (len + H265_BS_PADDING > reader->rbsp_size) {
+		/* Wanted capacity round up */
+		size_t size = (len + H265_BS_PADDING + 4095) & ~(size_t)4095;
+		uint8_t *newbuf = realloc(reader->rbsp_buf, size);
+		if (newbuf == NULL)
+			return -ENOMEM;
+		reader->rbsp_buf = newbuf;
+		reader->rbsp_size = size;
+	}
+
+	res = h265_nalu_to_rbsp(buf,
+				len,
+				reader->rbsp_buf,
+				rbsp_len,
+				reader->ep_pos,
+				reader->ep_size,
+				&reader->ep_count);
+	if (res < 0)
+		return res;
+
+	if (reader->ep_count > reader->ep_size) {
+		/* Not all positions were stored: convert again with a large
+		 * enough array (this only happens until the array has grown to
+		 * the maximum number of escape bytes of the stream) */
+		size_t size = (reader->ep_count + 63) & ~(size_t)63;
+		size_t *newpos =
+			realloc(reader->ep_pos, size * sizeof(*newpos));
+		if (newpos == NULL)
+			return -ENOMEM;
+		reader->ep_pos = newpos;
+		reader->ep_size = size;
+		res = h265_nalu_to_rbsp(buf,
+					len,
+					reader->rbsp_buf,
+					rbsp_len,
+					reader->ep_pos,
+					reader->ep_size,
+					&reader->ep_count);
+		if (res < 0)
+			return res;
+	}
+
+	/* Padding for the unchecked reads, see h265_bs_cinit_padded() */
+	memset(reader->rbsp_buf + *rbsp_len, 0, H265_BS_PADDING);
+	reader->rbsp_len = *rbsp_len;
+	return 0;
+}
+
+
 int h265_reader_parse_nalu(struct h265_reader *reader,
 			   uint32_t flags,
 			   const uint8_t *buf,
 			   size_t len)
 {
 	int res = 0;
+	size_t rbsp_len = 0;
+	enum h265_nalu_type type;
 	struct h265_bitstream bs;
 
 	ULOG_ERRNO_RETURN_ERR_IF(reader == NULL, EINVAL);
@@ -163,7 +584,30 @@ int h265_reader_parse_nalu(struct h265_reader *reader,
 
 	reader->stop = 0;
 	reader->flags = flags;
-	h265_bs_cinit(&bs, buf, len, 1);
+	reader->nalu_buf = buf;
+	reader->nalu_len = len;
+	reader->rbsp_len = 0;
+	reader->ep_count = 0;
+
+	type = len > 0 ? (buf[0] >> 1) & 0x3f : H265_NALU_TYPE_UNKNOWN;
+	if (type >= H265_NALU_TYPE_VPS_NUT &&
+	    !h265_reader_nalu_header_only(flags, type)) {
+		/* Non-VCL NAL units are parsed entirely: remove the emulation
+		 * prevention bytes in a single pass beforehand */
+		res = h265_reader_to_rbsp(reader, buf, len, &rbsp_len);
+		if (res < 0)
+			return res;
+		h265_bs_cinit_padded(&bs, reader->rbsp_buf, rbsp_len, 0);
+	} else if ((flags & H265_READER_FLAGS_PADDED) ||
+		   buf == reader->stream.buf) {
+		/* Same as below, the NAL unit being followed by padding */
+		h265_bs_cinit_padded(&bs, buf, len, 1);
+	} else {
+		/* Only the beginning of VCL NAL units (or only the header of
+		 * NAL units in selective parsing) is parsed, do not copy the
+		 * NAL unit data */
+		h265_bs_cinit(&bs, buf, len, 1);
+	}
 	bs.priv = reader;
 	res = _h265_read_nalu(&bs, reader->ctx, &reader->cbs, reader->userdata);
 	h265_bs_clear(&bs);
@@ -185,13 +629,28 @@ int h265_parse_nalu_header(const uint8_t *buf,
 	memset(nh, 0, sizeof(*nh));
 
 	h265_bs_cinit(&bs, buf, len, 1);
-	res = _h265_read_nalu_header(&bs, nh);
+	res = H265_READ_END(&bs, _h265_read_nalu_header(&bs, nh));
 	h265_bs_clear(&bs);
 
 	return res;
 }
 
 
+int h265_read_ps(struct h265_bitstream *bs, enum h265_nalu_type type, void *ps)
+{
+	switch (type) {
+	case H265_NALU_TYPE_VPS_NUT:
+		return H265_READ_END(bs, _h265_read_vps(bs, ps));
+	case H265_NALU_TYPE_SPS_NUT:
+		return H265_READ_END(bs, _h265_read_sps(bs, ps));
+	case H265_NALU_TYPE_PPS_NUT:
+		return H265_READ_END(bs, _h265_read_pps(bs, ps));
+	default:
+		return -EINVAL;
+	}
+}
+
+
 int h265_parse_vps(const uint8_t *buf, size_t len, struct h265_vps *vps)
 {
 	struct h265_bitstream bs;
@@ -202,7 +661,7 @@ int h265_parse_vps(const uint8_t *buf, size_t len, struct h265_vps *vps)
 
 	struct h265_nalu_header nh = {0};
 
-	int res = _h265_read_nalu_header(&bs, &nh);
+	int res = H265_READ_END(&bs, _h265_read_nalu_header(&bs, &nh));
 	if (res < 0)
 		goto out;
 	if (nh.nal_unit_type != H265_NALU_TYPE_VPS_NUT) {
@@ -213,7 +672,7 @@ int h265_parse_vps(const uint8_t *buf, size_t len, struct h265_vps *vps)
 		goto out;
 	}
 
-	res = _h265_read_vps(&bs, vps);
+	res = H265_READ_END(&bs, _h265_read_vps(&bs, vps));
 
 out:
 	h265_bs_clear(&bs);
@@ -231,7 +690,7 @@ int h265_parse_sps(const uint8_t *buf, size_t len, struct h265_sps *sps)
 
 	struct h265_nalu_header nh = {0};
 
-	int res = _h265_read_nalu_header(&bs, &nh);
+	int res = H265_READ_END(&bs, _h265_read_nalu_header(&bs, &nh));
 	if (res < 0)
 		goto out;
 	if (nh.nal_unit_type != H265_NALU_TYPE_SPS_NUT) {
@@ -242,7 +701,7 @@ int h265_parse_sps(const uint8_t *buf, size_t len, struct h265_sps *sps)
 		goto out;
 	}
 
-	res = _h265_read_sps(&bs, sps);
+	res = H265_READ_END(&bs, _h265_read_sps(&bs, sps));
 
 out:
 	h265_bs_clear(&bs);
@@ -260,7 +719,7 @@ int h265_parse_pps(const uint8_t *buf, size_t len, struct h265_pps *pps)
 
 	struct h265_nalu_header nh = {0};
 
-	int res = _h265_read_nalu_header(&bs, &nh);
+	int res = H265_READ_END(&bs, _h265_read_nalu_header(&bs, &nh));
 	if (res < 0)
 		goto out;
 	if (nh.nal_unit_type != H265_NALU_TYPE_PPS_NUT) {
@@ -271,7 +730,7 @@ int h265_parse_pps(const uint8_t *buf, size_t len, struct h265_pps *pps)
 		goto out;
 	}
 
-	res = _h265_read_pps(&bs, pps);
+	res = H265_READ_END(&bs, _h265_read_pps(&bs, pps));
 
 out:
 	h265_bs_clear(&bs);
@@ -0,0 +1,871 @@
+/**
+ * Copyright (c) 2019 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Drones SAS Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT DRONES SAS COMPANY BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "h265_priv.h"
+
+
+/* RFC 3550 5.1 RTP fixed header fields */
+#define H265_RTP_HEADER_SIZE 12
+#define H265_RTP_VERSION 2
+
+/* 4.4 Payload header size (same as the NAL unit header) */
+#define H265_RTP_PAYLOAD_HEADER_SIZE 2
+
+/* Number of consecutive packets behind the last sequence number after which
+ * the sender is assumed to have restarted its sequence (RFC 3550 A.1 uses a
+ * similar probation) */
+#define H265_RTP_MAX_LATE 3
+
+
+struct h265_rtp_depay {
+	struct h265_rtp_depay_cfg cfg;
+	struct h265_rtp_depay_cbs cbs;
+	void *userdata;
+	struct h265_rtp_depay_stats stats;
+
+	/* Sequence number of the last packet, and number of consecutive
+	 * packets dropped as duplicate or late since then */
+	uint16_t seq_num;
+	int seq_num_valid;
+	unsigned int late_count;
+
+	/* Current access unit: timestamp, whether a NAL unit has been
+	 * output and whether packets were lost */
+	uint32_t timestamp;
+	int in_au;
+	int au_loss;
+
+	/* NAL unit being reassembled from FUs, or NAL unit of a single NAL
+	 * unit packet with a DONL field; the buffer is kept between NAL
+	 * units */
+	uint8_t *buf;
+	size_t len;
+	size_t size;
+	int in_fu;
+	uint16_t fu_don;
+};
+
+
+int h265_rtp_depay_new(const struct h265_rtp_depay_cfg *cfg,
+		       const struct h265_rtp_depay_cbs *cbs,
+		       void *userdata,
+		       struct h265_rtp_depay **ret_obj)
+{
+	struct h265_rtp_depay *depay;
+
+	ULOG_ERRNO_RETURN_ERR_IF(cfg == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(cfg->reader_flags &
+					 (H265_READER_FLAGS_STREAM |
+					  H265_READER_FLAGS_PADDED),
+				 EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(ret_obj == NULL, EINVAL);
+
+	depay = calloc(1, sizeof(*depay));
+	if (depay == NULL)
+		return -ENOMEM;
+
+	depay->cfg = *cfg;
+	if (cbs != NULL)
+		depay->cbs = *cbs;
+	depay->userdata = userdata;
+
+	*ret_obj = depay;
+	return 0;
+}
+
+
+int h265_rtp_depay_destroy(struct h265_rtp_depay *depay)
+{
+	if (depay == NULL)
+		return 0;
+
+	free(depay->buf);
+	free(depay);
+
+	return 0;
+}
+
+
+static int h265_rtp_depay_append(struct h265_rtp_depay *depay,
+				 const uint8_t *buf,
+				 size_t len)
+{
+	size_t size = depay->len + len;
+
+	if (size > depay->size) {
+		/* Wanted capacity round up, grow geometrically */
+		if (size < 2 * depay->size)
+			size = 2 * depay->size;
+		size = (size + 4095) & ~(size_t)4095;
+		uint8_t *newbuf = realloc(depay->buf, size);
+		if (newbuf == NULL)
+			return -ENOMEM;
+		depay->buf = newbuf;
+		depay->size = size;
+	}
+
+	memcpy(depay->buf + depay->len, buf, len);
+	depay->len += len;
+	return 0;
+}
+
+
+static void h265_rtp_depay_au_end(struct h265_rtp_depay *depay)
+{
+	if (!depay->in_au)
+		return;
+
+	depay->stats.aus++;
+	if (depay->au_loss)
+		depay->stats.incomplete_aus++;
+	if (depay->cbs.au_end != NULL) {
+		(*depay->cbs.au_end)(depay,
+				     depay->timestamp,
+				     !depay->au_loss,
+				     depay->userdata);
+	}
+	depay->in_au = 0;
+	depay->au_loss = 0;
+}
+
+
+static void h265_rtp_depay_drop_fu(struct h265_rtp_depay *depay)
+{
+	if (!depay->in_fu)
+		return;
+
+	depay->stats.dropped_nalus++;
+	depay->au_loss = 1;
+	depay->in_fu = 0;
+	depay->len = 0;
+}
+
+
+static void h265_rtp_depay_output(struct h265_rtp_depay *depay,
+				  const uint8_t *buf,
+				  size_t len,
+				  const struct h265_rtp_nalu_info *info)
+{
+	int res;
+
+	/* The marker bit of the previous access unit was not received */
+	if (depay->in_au && info->timestamp != depay->timestamp)
+		h265_rtp_depay_au_end(depay);
+
+	if (!depay->in_au) {
+		depay->in_au = 1;
+		depay->timestamp = info->timestamp;
+	}
+
+	depay->stats.nalus++;
+	if (depay->cbs.nalu != NULL)
+		(*depay->cbs.nalu)(depay, buf, len, info, depay->userdata);
+	if (depay->cfg.reader != NULL) {
+		res = h265_reader_parse_nalu(
+			depay->cfg.reader, depay->cfg.reader_flags, buf, len);
+		if (res < 0)
+			ULOG_ERRNO("h265_reader_parse_nalu", -res);
+	}
+}
+
+
+/* 4.4.1 Single NAL unit packets */
+static int h265_rtp_depay_single(struct h265_rtp_depay *depay,
+				 const uint8_t *buf,
+				 size_t len,
+				 struct h265_rtp_nalu_info *info)
+{
+	int res;
+
+	if (depay->cfg.max_don_diff == 0) {
+		/* The payload is the NAL unit */
+		h265_rtp_depay_output(depay, buf, len, info);
+		return 0;
+	}
+
+	/* Remove the DONL field following the payload header */
+	if (len < H265_RTP_PAYLOAD_HEADER_SIZE + 2)
+		return -EPROTO;
+	info->don = (buf[2] << 8) | buf[3];
+	depay->len = 0;
+	res = h265_rtp_depay_append(depay, buf, H265_RTP_PAYLOAD_HEADER_SIZE);
+	if (res < 0)
+		return res;
+	res = h265_rtp_depay_append(depay,
+				    buf + H265_RTP_PAYLOAD_HEADER_SIZE + 2,
+				    len - H265_RTP_PAYLOAD_HEADER_SIZE - 2);
+	if (res < 0)
+		return res;
+	h265_rtp_depay_output(depay, depay->buf, depay->len, info);
+	depay->len = 0;
+	return 0;
+}
+
+
+/* 4.4.2 Aggregation packets */
+static int h265_rtp_depay_ap(struct h265_rtp_depay *depay,
+			     const uint8_t *buf,
+			     size_t len,
+			     struct h265_rtp_nalu_info *info)
+{
+	size_t off = H265_RTP_PAYLOAD_HEADER_SIZE, nalu_len;
+	uint32_t count = 0;
+
+	while (off < len) {
+		if (depay->cfg.max_don_diff > 0) {
+			/* DONL for the first aggregation unit, DOND for the
+			 * following ones */
+			if (count == 0) {
+				if (len - off < 2)
+					return -EPROTO;
+				info->don = (buf[off] << 8) | buf[off + 1];
+				off += 2;
+			} else {
+				if (len - off < 1)
+					return -EPROTO;
+				info->don += buf[off] + 1;
+				off++;
+			}
+		}
+		if (len - off < 2)
+			return -EPROTO;
+		nalu_len = (buf[off] << 8) | buf[off + 1];
+		off += 2;
+		if (nalu_len < 2 || nalu_len > len - off)
+			return -EPROTO;
+
+		h265_rtp_depay_output(depay, buf + off, nalu_len, info);
+		off += nalu_len;
+		count++;
+	}
+
+	/* An AP contains at least two aggregation units */
+	return count >= 2 ? 0 : -EPROTO;
+}
+
+
+/* 4.4.3 Fragmentation units */
+static int h265_rtp_depay_fu(struct h265_rtp_depay *depay,
+			     const uint8_t *buf,
+			     size_t len,
+			     struct h265_rtp_nalu_info *info)
+{
+	int res;
+	size_t off = H265_RTP_PAYLOAD_HEADER_SIZE + 1;
+	uint8_t fu_header, fu_type, nh[2];
+	int start, end;
+
+	if (len < off)
+		return -EPROTO;
+	fu_header = buf[H265_RTP_PAYLOAD_HEADER_SIZE];
+	start = (fu_header >> 7) & 0x1;
+	end = (fu_header >> 6) & 0x1;
+	fu_type = fu_header & 0x3f;
+
+	/* The FuType cannot be the one of an AP, FU or PACI; an invalid
+	 * fragment is a loss for the NAL unit being reassembled */
+	if ((start && end) || fu_type == H265_RTP_TYPE_AP ||
+	    fu_type == H265_RTP_TYPE_FU || fu_type == H265_RTP_TYPE_PACI) {
+		h265_rtp_depay_drop_fu(depay);
+		return -EPROTO;
+	}
+
+	if (start) {
+		/* A missing end fragment is a loss, even without sequence
+		 * number gap */
+		h265_rtp_depay_drop_fu(depay);
+		if (depay->cfg.max_don_diff > 0) {
+			if (len - off < 2)
+				return -EPROTO;
+			depay->fu_don = (buf[off] << 8) | buf[off + 1];
+			off += 2;
+		}
+
+		/* NAL unit header: payload header with the FuType */
+		nh[0] = (buf[0] & 0x81) | (fu_type << 1);
+		nh[1] = buf[1];
+		depay->len = 0;
+		res = h265_rtp_depay_append(depay, nh, sizeof(nh));
+		if (res < 0)
+			return res;
+		depay->in_fu = 1;
+	} else if (!depay->in_fu) {
+		/* The start fragment was lost */
+		return 0;
+	}
+
+	res = h265_rtp_depay_append(depay, buf + off, len - off);
+	if (res < 0) {
+		h265_rtp_depay_drop_fu(depay);
+		return res;
+	}
+
+	if (end) {
+		info->don = depay->fu_don;
+		info->fragmented = 1;
+		h265_rtp_depay_output(depay, depay->buf, depay->len, info);
+		depay->in_fu = 0;
+		depay->len = 0;
+	}
+
+	return 0;
+}
+
+
+int h265_rtp_depay_process(struct h265_rtp_depay *depay,
+			   const uint8_t *buf,
+			   size_t len)
+{
+	int res;
+	size_t off = H265_RTP_HEADER_SIZE;
+	uint32_t csrc_count, type;
+	int padding, extension, marker;
+	uint16_t seq_num, gap;
+	struct h265_rtp_nalu_info info = {0};
+
+	ULOG_ERRNO_RETURN_ERR_IF(depay == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(buf == NULL, EINVAL);
+
+	depay->stats.packets++;
+
+	/* RFC 3550 5.1 RTP fixed header fields */
+	if (len < H265_RTP_HEADER_SIZE || (buf[0] >> 6) != H265_RTP_VERSION)
+		goto invalid;
+	padding = (buf[0] >> 5) & 0x1;
+	extension = (buf[0] >> 4) & 0x1;
+	csrc_count = buf[0] & 0xf;
+	marker = (buf[1] >> 7) & 0x1;
+	seq_num = (buf[2] << 8) | buf[3];
+	info.timestamp = ((uint32_t)buf[4] << 24) | (buf[5] << 16) |
+			 (buf[6] << 8) | buf[7];
+	info.seq_num = seq_num;
+
+	off += 4 * csrc_count;
+	if (extension) {
+		/* RFC 3550 5.3.1 RTP header extension */
+		if (len < off + 4)
+			goto invalid;
+		off += 4 + 4 * (size_t)((buf[off + 2] << 8) | buf[off + 3]);
+	}
+	if (padding) {
+		if (len == 0 || buf[len - 1] > len)
+			goto invalid;
+		len -= buf[len - 1];
+	}
+	if (len < off + H265_RTP_PAYLOAD_HEADER_SIZE)
+		goto invalid;
+
+	/* Packet loss, or duplicate or late packet */
+	if (depay->seq_num_valid) {
+		gap = seq_num - depay->seq_num - 1;
+		if (gap >= 0x8000 &&
+		    ++depay->late_count < H265_RTP_MAX_LATE) {
+			ULOGD("%s: dropping late packet (seq %u, last %u)",
+			      __func__,
+			      seq_num,
+			      depay->seq_num);
+			depay->stats.dropped_packets++;
+			return 0;
+		} else if (gap >= 0x8000) {
+			/* Sequence discontinuity: restart from this packet */
+			ULOGW("%s: sequence restart (seq %u, last %u)",
+			      __func__,
+			      seq_num,
+			      depay->seq_num);
+			h265_rtp_depay_drop_fu(depay);
+			depay->au_loss = 1;
+		} else if (gap > 0) {
+			ULOGD("%s: %u packets lost", __func__, gap);
+			depay->stats.lost_packets += gap;
+			h265_rtp_depay_drop_fu(depay);
+			depay->au_loss = 1;
+		}
+	}
+	depay->seq_num = seq_num;
+	depay->seq_num_valid = 1;
+	depay->late_count = 0;
+
+	buf += off;
+	len -= off;
+	type = (buf[0] >> 1) & 0x3f;
+	if (type != H265_RTP_TYPE_FU)
+		h265_rtp_depay_drop_fu(depay);
+
+	switch (type) {
+	case H265_RTP_TYPE_AP:
+		res = h265_rtp_depay_ap(depay, buf, len, &info);
+		break;
+	case H265_RTP_TYPE_FU:
+		res = h265_rtp_depay_fu(depay, buf, len, &info);
+		break;
+	case H265_RTP_TYPE_PACI:
+		/* PACI packets are not supported */
+		ULOGD("%s: dropping PACI packet", __func__);
+		depay->stats.dropped_packets++;
+		depay->au_loss = 1;
+		res = 0;
+		break;
+	default:
+		res = h265_rtp_depay_single(depay, buf, len, &info);
+		break;
+	}
+	if (res == -EPROTO)
+		goto invalid;
+	else if (res < 0)
+		return res;
+
+	/* 4.1: the marker bit is set on the last packet of the access
+	 * unit */
+	if (marker) {
+		if (!depay->in_au) {
+			/* Access unit with no NAL unit output */
+			depay->in_au = 1;
+			depay->timestamp = info.timestamp;
+		}
+		h265_rtp_depay_au_end(depay);
+	}
+
+	return 0;
+
+invalid:
+	ULOGE("%s: invalid packet (seq %u)", __func__, info.seq_num);
+	depay->stats.dropped_packets++;
+	depay->au_loss = 1;
+	return -EPROTO;
+}
+
+
+int h265_rtp_depay_flush(struct h265_rtp_depay *depay)
+{
+	ULOG_ERRNO_RETURN_ERR_IF(depay == NULL, EINVAL);
+
+	h265_rtp_depay_drop_fu(depay);
+	h265_rtp_depay_au_end(depay);
+
+	return 0;
+}
+
+
+int h265_rtp_depay_get_stats(struct h265_rtp_depay *depay,
+			     struct h265_rtp_depay_stats *stats)
+{
+	ULOG_ERRNO_RETURN_ERR_IF(depay == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(stats == NULL, EINVAL);
+
+	*stats = depay->stats;
+
+	return 0;
+}
+
+
+/* Smallest MTU: RTP header, payload header, FU header and one byte of NAL
+ * unit data */
+#define H265_RTP_MTU_MIN 16
+
+
+struct h265_rtp_pay {
+	struct h265_rtp_pay_cfg cfg;
+	struct h265_rtp_pay_cbs cbs;
+	void *userdata;
+	uint16_t seq_num;
+
+	/* Packets of the current access unit, their buffers and the headers
+	 * owned by the packetizer; the storage is kept between access
+	 * units */
+	struct h265_rtp_packet *packets;
+	size_t packets_size;
+	struct iovec *iov;
+	size_t iov_size;
+	uint8_t *headers;
+	size_t headers_size;
+};
+
+
+/* Packets being built; in the sizing pass (fill equal to 0) only the counts
+ * are updated */
+struct h265_rtp_builder {
+	struct h265_rtp_pay *pay;
+	int fill;
+	size_t packet_count;
+	size_t iov_count;
+	size_t header_len;
+
+	/* The last buffer of the current packet is a header buffer */
+	int in_header;
+};
+
+
+int h265_rtp_pay_new(const struct h265_rtp_pay_cfg *cfg,
+		     const struct h265_rtp_pay_cbs *cbs,
+		     void *userdata,
+		     struct h265_rtp_pay **ret_obj)
+{
+	struct h265_rtp_pay *pay;
+
+	ULOG_ERRNO_RETURN_ERR_IF(cfg == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(cfg->mtu < H265_RTP_MTU_MIN, EINVAL);
+	/* The aggregation units sizes are 16-bit */
+	ULOG_ERRNO_RETURN_ERR_IF(cfg->mtu > UINT16_MAX, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(cfg->payload_type > 127, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(ret_obj == NULL, EINVAL);
+
+	pay = calloc(1, sizeof(*pay));
+	if (pay == NULL)
+		return -ENOMEM;
+
+	pay->cfg = *cfg;
+	if (cbs != NULL)
+		pay->cbs = *cbs;
+	pay->userdata = userdata;
+	pay->seq_num = cfg->seq_num;
+
+	*ret_obj = pay;
+	return 0;
+}
+
+
+int h265_rtp_pay_destroy(struct h265_rtp_pay *pay)
+{
+	if (pay == NULL)
+		return 0;
+
+	free(pay->packets);
+	free(pay->iov);
+	free(pay->headers);
+	free(pay);
+
+	return 0;
+}
+
+
+/* 4.4 Payload header, same as the NAL unit header */
+static void h265_rtp_write_payload_header(uint8_t *buf,
+					  const struct h265_nalu_header *nh)
+{
+	buf[0] = ((nh->forbidden_zero_bit & 0x1) << 7) |
+		 ((nh->nal_unit_type & 0x3f) << 1) |
+		 ((nh->nuh_layer_id >> 5) & 0x1);
+	buf[1] = ((nh->nuh_layer_id & 0x1f) << 3) |
+		 (nh->nuh_temporal_id_plus1 & 0x7);
+}
+
+
+static void h265_rtp_builder_header(struct h265_rtp_builder *b,
+				    const uint8_t *buf,
+				    size_t len)
+{
+	struct h265_rtp_pay *pay = b->pay;
+
+	if (b->fill) {
+		struct h265_rtp_packet *packet =
+			&pay->packets[b->packet_count - 1];
+		memcpy(pay->headers + b->header_len, buf, len);
+		if (b->in_header) {
+			pay->iov[b->iov_count - 1].iov_len += len;
+		} else {
+			pay->iov[b->iov_count].iov_base =
+				pay->headers + b->header_len;
+			pay->iov[b->iov_count].iov_len = len;
+			packet->iov_count++;
+		}
+		packet->len += len;
+	}
+	if (!b->in_header)
+		b->iov_count++;
+	b->header_len += len;
+	b->in_header = 1;
+}
+
+
+static void h265_rtp_builder_data(struct h265_rtp_builder *b,
+				  const uint8_t *buf,
+				  size_t len)
+{
+	struct h265_rtp_pay *pay = b->pay;
+
+	if (b->fill) {
+		struct h265_rtp_packet *packet =
+			&pay->packets[b->packet_count - 1];
+		pay->iov[b->iov_count].iov_base = (void *)buf;
+		pay->iov[b->iov_count].iov_len = len;
+		packet->iov_count++;
+		packet->len += len;
+	}
+	b->iov_count++;
+	b->in_header = 0;
+}
+
+
+/* RFC 3550 5.1 RTP fixed header fields; the marker bit is set once all the
+ * packets are built */
+static void h265_rtp_builder_packet(struct h265_rtp_builder *b,
+				    uint32_t timestamp)
+{
+	struct h265_rtp_pay *pay = b->pay;
+	uint16_t seq_num = pay->seq_num + b->packet_count;
+	uint8_t header[H265_RTP_HEADER_SIZE];
+
+	if (b->fill) {
+		pay->packets[b->packet_count] = (struct h265_rtp_packet){
+			.iov = &pay->iov[b->iov_count],
+			.seq_num = seq_num,
+		};
+	}
+	b->packet_count++;
+	b->in_header = 0;
+
+	header[0] = H265_RTP_VERSION << 6;
+	header[1] = pay->cfg.payload_type;
+	header[2] = seq_num >> 8;
+	header[3] = seq_num & 0xff;
+	header[4] = timestamp >> 24;
+	header[5] = (timestamp >> 16) & 0xff;
+	header[6] = (timestamp >> 8) & 0xff;
+	header[7] = timestamp & 0xff;
+	header[8] = pay->cfg.ssrc >> 24;
+	header[9] = (pay->cfg.ssrc >> 16) & 0xff;
+	header[10] = (pay->cfg.ssrc >> 8) & 0xff;
+	header[11] = pay->cfg.ssrc & 0xff;
+	h265_rtp_builder_header(b, header, sizeof(header));
+}
+
+
+/* 4.4.2 Aggregation packets: the payload header F bit is the OR of those of
+ * the aggregated NAL units, and its LayerId and TID are the lowest ones */
+static int h265_rtp_build_ap(struct h265_rtp_builder *b,
+			     const struct h265_rtp_pay_nalu *nalus,
+			     size_t count,
+			     uint32_t timestamp)
+{
+	int res;
+	struct h265_nalu_header nh, ap_nh = {
+		.nal_unit_type = H265_RTP_TYPE_AP,
+		.nuh_layer_id = 63,
+		.nuh_temporal_id_plus1 = 7,
+	};
+	uint8_t buf[H265_RTP_PAYLOAD_HEADER_SIZE];
+
+	if (b->fill) {
+		for (size_t i = 0; i < count; i++) {
+			res = h265_parse_nalu_header(
+				nalus[i].buf, nalus[i].len, &nh);
+			if (res < 0)
+				return res;
+			ap_nh.forbidden_zero_bit |= nh.forbidden_zero_bit;
+			if (nh.nuh_layer_id < ap_nh.nuh_layer_id)
+				ap_nh.nuh_layer_id = nh.nuh_layer_id;
+			if (nh.nuh_temporal_id_plus1 <
+			    ap_nh.nuh_temporal_id_plus1)
+				ap_nh.nuh_temporal_id_plus1 =
+					nh.nuh_temporal_id_plus1;
+		}
+	}
+
+	h265_rtp_builder_packet(b, timestamp);
+	h265_rtp_write_payload_header(buf, &ap_nh);
+	h265_rtp_builder_header(b, buf, sizeof(buf));
+	for (size_t i = 0; i < count; i++) {
+		buf[0] = nalus[i].len >> 8;
+		buf[1] = nalus[i].len & 0xff;
+		h265_rtp_builder_header(b, buf, 2);
+		h265_rtp_builder_data(b, nalus[i].buf, nalus[i].len);
+	}
+
+	return 0;
+}
+
+
+/* 4.4.3 Fragmentation units: the payload header is the NAL unit header with
+ * the FU type, and the FU header holds the NAL unit type */
+static int h265_rtp_build_fu(struct h265_rtp_builder *b,
+			     const struct h265_rtp_pay_nalu *nalu,
+			     uint32_t timestamp)
+{
+	int res;
+	struct h265_nalu_header nh = {0};
+	size_t max = b->pay->cfg.mtu - H265_RTP_HEADER_SIZE -
+		     H265_RTP_PAYLOAD_HEADER_SIZE - 1;
+	size_t off = H265_RTP_PAYLOAD_HEADER_SIZE, len;
+	uint8_t buf[H265_RTP_PAYLOAD_HEADER_SIZE + 1];
+	uint32_t type;
+
+	if (b->fill) {
+		res = h265_parse_nalu_header(nalu->buf, nalu->len, &nh);
+		if (res < 0)
+			return res;
+	}
+	type = nh.nal_unit_type;
+	nh.nal_unit_type = H265_RTP_TYPE_FU;
+	h265_rtp_write_payload_header(buf, &nh);
+
+	while (off < nalu->len) {
+		len = nalu->len - off;
+		if (len > max)
+			len = max;
+		buf[2] = type & 0x3f;
+		if (off == H265_RTP_PAYLOAD_HEADER_SIZE)
+			buf[2] |= 0x80;
+		if (off + len == nalu->len)
+			buf[2] |= 0x40;
+		h265_rtp_builder_packet(b, timestamp);
+		h265_rtp_builder_header(b, buf, sizeof(buf));
+		h265_rtp_builder_data(b, nalu->buf + off, len);
+		off += len;
+	}
+
+	return 0;
+}
+
+
+static int h265_rtp_pay_build(struct h265_rtp_builder *b,
+			      const struct h265_rtp_pay_nalu *nalus,
+			      size_t count,
+			      uint32_t timestamp)
+{
+	int res;
+	size_t max = b->pay->cfg.mtu - H265_RTP_HEADER_SIZE;
+	size_t i = 0, j, ap_len;
+
+	while (i < count) {
+		if (nalus[i].len > max) {
+			res = h265_rtp_build_fu(b, &nalus[i], timestamp);
+			if (res < 0)
+				return res;
+			i++;
+			continue;
+		}
+
+		/* Aggregate the following NAL units fitting in the packet */
+		ap_len = H265_RTP_PAYLOAD_HEADER_SIZE + 2 + nalus[i].len;
+		for (j = i + 1; j < count; j++) {
+			if (ap_len + 2 + nalus[j].len > max)
+				break;
+			ap_len += 2 + nalus[j].len;
+		}
+		if (j - i >= 2) {
+			res = h265_rtp_build_ap(b, &nalus[i], j - i, timestamp);
+			if (res < 0)
+				return res;
+			i = j;
+			continue;
+		}
+
+		/* 4.4.1 Single NAL unit packet: the payload is the NAL
+		 * unit */
+		h265_rtp_builder_packet(b, timestamp);
+		h265_rtp_builder_data(b, nalus[i].buf, nalus[i].len);
+		i++;
+	}
+
+	return 0;
+}
+
+
+static int h265_rtp_pay_reserve(void **buf,
+				size_t *size,
+				size_t count,
+				size_t elem_size)
+{
+	void *newbuf;
+
+	if (count <= *size)
+		return 0;
+	newbuf = realloc(*buf, count * elem_size);
+	if (newbuf == NULL)
+		return -ENOMEM;
+	*buf = newbuf;
+	*size = count;
+	return 0;
+}
+
+
+int h265_rtp_pay_process(struct h265_rtp_pay *pay,
+			 const struct h265_rtp_pay_nalu *nalus,
+			 size_t count,
+			 uint32_t timestamp)
+{
+	int res;
+	struct h265_rtp_builder b = {
+		.pay = pay,
+	};
+	struct h265_rtp_packet *last;
+
+	ULOG_ERRNO_RETURN_ERR_IF(pay == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(nalus == NULL && count > 0, EINVAL);
+	for (size_t i = 0; i < count; i++) {
+		ULOG_ERRNO_RETURN_ERR_IF(nalus[i].buf == NULL, EINVAL);
+		ULOG_ERRNO_RETURN_ERR_IF(
+			nalus[i].len < H265_RTP_PAYLOAD_HEADER_SIZE, EINVAL);
+	}
+	if (count == 0)
+		return 0;
+
+	/* Count the packets, buffers and header bytes first, so that the
+	 * storage does not move while the packets are built */
+	res = h265_rtp_pay_build(&b, nalus, count, timestamp);
+	if (res < 0)
+		return res;
+	res = h265_rtp_pay_reserve((void **)&pay->packets,
+				   &pay->packets_size,
+				   b.packet_count,
+				   sizeof(*pay->packets));
+	if (res < 0)
+		return res;
+	res = h265_rtp_pay_reserve((void **)&pay->iov,
+				   &pay->iov_size,
+				   b.iov_count,
+				   sizeof(*pay->iov));
+	if (res < 0)
+		return res;
+	res = h265_rtp_pay_reserve((void **)&pay->headers,
+				   &pay->headers_size,
+				   b.header_len,
+				   sizeof(*pay->headers));
+	if (res < 0)
+		return res;
+
+	b = (struct h265_rtp_builder){
+		.pay = pay,
+		.fill = 1,
+	};
+	res = h265_rtp_pay_build(&b, nalus, count, timestamp);
+	if (res < 0)
+		return res;
+
+	/* 4.1: the marker bit is set on the last packet of the access
+	 * unit (the RTP header is at the start of the first buffer) */
+	last = &pay->packets[b.packet_count - 1];
+	last->marker = 1;
+	((uint8_t *)last->iov[0].iov_base)[1] |= 0x80;
+
+	pay->seq_num += b.packet_count;
+	if (pay->cbs.packets != NULL) {
+		(*pay->cbs.packets)(
+			pay, pay->packets, b.packet_count, pay->userdata);
+	}
+
+	return 0;
+}
@@ -0,0 +1,222 @@
+/**
+ * Copyright (c) 2019 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Drones SAS Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT DRONES SAS COMPANY BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "h265_priv.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#	define H265_SCAN_X86
+#	include <immintrin.h>
+#endif
+
+
+/* Most significant bit of each zero byte of x set, other bits cleared */
+static inline uint64_t h265_scan_zero_bytes(uint64_t x)
+{
+	const uint64_t lo7 = UINT64_C(0x7f7f7f7f7f7f7f7f);
+	return ~(((x & lo7) + lo7) | x | lo7);
+}
+
+
+/**
+ * Portable version, 8 bytes at a time: bytes are loaded most significant
+ * first so that the flag of byte i+1 is moved onto byte i by a left shift.
+ * Each load checks the pairs starting on its first 7 bytes.
+ */
+static size_t h265_scan_zero_pair_c(const uint8_t *buf, size_t len)
+{
+	size_t i = 0;
+	uint64_t z = 0;
+
+	for (; i + 8 <= len; i += 7) {
+		z = h265_scan_zero_bytes(h265_bs_load_be64(buf + i));
+		z &= z << 8;
+		if (z != 0)
+			return i + h265_clz64(z) / 8;
+	}
+	for (; i + 1 < len; i++) {
+		if (buf[i] == 0x00 && buf[i + 1] == 0x00)
+			return i;
+	}
+	return len;
+}
+
+
+/**
+ * Portable version of the start code candidate scan, 8 bytes at a time;
+ * each load checks the candidates starting on its first 6 bytes.
+ */
+static size_t h265_scan_start_code_c(const uint8_t *buf, size_t len)
+{
+	size_t i = 0;
+	uint64_t w = 0, z = 0, le1 = 0;
+
+	for (; i + 8 <= len; i += 6) {
+		w = h265_bs_load_be64(buf + i);
+		z = h265_scan_zero_bytes(w);
+		le1 = h265_scan_zero_bytes(w & UINT64_C(0xfefefefefefefefe));
+		z &= (z << 8) & (le1 << 16);
+		if (z != 0)
+			return i + h265_clz64(z) / 8;
+	}
+	for (; i + 2 < len; i++) {
+		if (buf[i] == 0x00 && buf[i + 1] == 0x00 && buf[i + 2] <= 0x01)
+			return i;
+	}
+	return len;
+}
+
+
+#ifdef H265_SCAN_X86
+
+__attribute__((target("sse2"))) static size_t
+h265_scan_zero_pair_sse2(const uint8_t *buf, size_t len)
+{
+	const __m128i zero = _mm_setzero_si128();
+	size_t i = 0;
+
+	/* Compare each byte and its successor to zero, 16 pairs at a time */
+	for (; i + 17 <= len; i += 16) {
+		__m128i a = _mm_loadu_si128((const __m128i *)(buf + i));
+		__m128i b = _mm_loadu_si128((const __m128i *)(buf + i + 1));
+		__m128i z = _mm_and_si128(_mm_cmpeq_epi8(a, zero),
+					  _mm_cmpeq_epi8(b, zero));
+		uint32_t mask = _mm_movemask_epi8(z);
+		if (mask != 0)
+			return i + __builtin_ctz(mask);
+	}
+
+	return i + h265_scan_zero_pair_c(buf + i, len - i);
+}
+
+
+__attribute__((target("avx2"))) static size_t
+h265_scan_zero_pair_avx2(const uint8_t *buf, size_t len)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	size_t i = 0;
+
+	/* Compare each byte and its successor to zero, 32 pairs at a time */
+	for (; i + 33 <= len; i += 32) {
+		__m256i a = _mm256_loadu_si256((const __m256i *)(buf + i));
+		__m256i b = _mm256_loadu_si256((const __m256i *)(buf + i + 1));
+		__m256i z = _mm256_and_si256(_mm256_cmpeq_epi8(a, zero),
+					     _mm256_cmpeq_epi8(b, zero));
+		uint32_t mask = _mm256_movemask_epi8(z);
+		if (mask != 0)
+			return i + __builtin_ctz(mask);
+	}
+
+	return i + h265_scan_zero_pair_sse2(buf + i, len - i);
+}
+
+
+__attribute__((target("sse2"))) static size_t
+h265_scan_start_code_sse2(const uint8_t *buf, size_t len)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i one = _mm_set1_epi8(1);
+	size_t i = 0;
+
+	/* Look for 00 00 0x (x <= 1) at 16 positions at a time */
+	for (; i + 18 <= len; i += 16) {
+		__m128i a = _mm_loadu_si128((const __m128i *)(buf + i));
+		__m128i b = _mm_loadu_si128((const __m128i *)(buf + i + 1));
+		__m128i c = _mm_loadu_si128((const __m128i *)(buf + i + 2));
+		__m128i z = _mm_and_si128(_mm_cmpeq_epi8(a, zero),
+					  _mm_cmpeq_epi8(b, zero));
+		z = _mm_and_si128(z, _mm_cmpeq_epi8(_mm_min_epu8(c, one), c));
+		uint32_t mask = _mm_movemask_epi8(z);
+		if (mask != 0)
+			return i + __builtin_ctz(mask);
+	}
+
+	return i + h265_scan_start_code_c(buf + i, len - i);
+}
+
+
+__attribute__((target("avx2"))) static size_t
+h265_scan_start_code_avx2(const uint8_t *buf, size_t len)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i one = _mm256_set1_epi8(1);
+	size_t i = 0;
+
+	/* Look for 00 00 0x (x <= 1) at 32 positions at a time */
+	for (; i + 34 <= len; i += 32) {
+		__m256i a = _mm256_loadu_si256((const __m256i *)(buf + i));
+		__m256i b = _mm256_loadu_si256((const __m256i *)(buf + i + 1));
+		__m256i c = _mm256_loadu_si256((const __m256i *)(buf + i + 2));
+		__m256i z = _mm256_and_si256(_mm256_cmpeq_epi8(a, zero),
+					     _mm256_cmpeq_epi8(b, zero));
+		z = _mm256_and_si256(
+			z, _mm256_cmpeq_epi8(_mm256_min_epu8(c, one), c));
+		uint32_t mask = _mm256_movemask_epi8(z);
+		if (mask != 0)
+			return i + __builtin_ctz(mask);
+	}
+
+	return i + h265_scan_start_code_sse2(buf + i, len - i);
+}
+
+#endif /* H265_SCAN_X86 */
+
+
+/* Implementations for the CPU, selected once by h265_scan_init() */
+static size_t (*h265_scan_zero_pair_impl)(const uint8_t *buf,
+					  size_t len) = h265_scan_zero_pair_c;
+static size_t (*h265_scan_start_code_impl)(const uint8_t *buf,
+					   size_t len) = h265_scan_start_code_c;
+
+
+#ifdef H265_SCAN_X86
+
+/* __builtin_cpu_init() must be called before __builtin_cpu_supports() in a
+ * constructor, which may run before the one initializing the CPU model */
+__attribute__((constructor)) static void h265_scan_init(void)
+{
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		h265_scan_zero_pair_impl = h265_scan_zero_pair_avx2;
+		h265_scan_start_code_impl = h265_scan_start_code_avx2;
+	} else if (__builtin_cpu_supports("sse2")) {
+		h265_scan_zero_pair_impl = h265_scan_zero_pair_sse2;
+		h265_scan_start_code_impl = h265_scan_start_code_sse2;
+	}
+}
+
+#endif /* H265_SCAN_X86 */
+
+
+size_t h265_scan_zero_pair(const uint8_t *buf, size_t len)
+{
+	return (*h265_scan_zero_pair_impl)(buf, len);
+}
+
+
+size_t h265_scan_start_code(const uint8_t *buf, size_t len)
+{
+	return (*h265_scan_start_code_impl)(buf, len);
+}
@@ -33,6 +33,11 @@
 #include "h265_syntax_ops.h"
 
 
+/* Upper bound of the picture width and height in CTBs for all the levels of
+ * Annex A: at most sqrt(8 * MaxLumaPs) luma samples (A.4.1), and 16x16 CTBs */
+#define H265_TILES_MAX 1056
+
+
 static int H265_SYNTAX_FCT(sei_data)(struct h265_bitstream *bs,
 				     /* clang-format off */
 				     const uint8_t *H265_SYNTAX_CONST*buf,
@@ -41,13 +46,12 @@ static int H265_SYNTAX_FCT(sei_data)(struct h265_bitstream *bs,
 {
 #if H265_SYNTAX_OP_KIND == H265_SYNTAX_OP_KIND_READ
 	ULOG_ERRNO_RETURN_ERR_IF(!h265_bs_byte_aligned(bs), EIO);
-	*buf = bs->cdata + bs->off;
-	*len = bs->len - bs->off;
+	*buf = bs->cdata + h265_bs_read_off(bs);
+	*len = bs->len - h265_bs_read_off(bs);
 #else
 	ULOG_ERRNO_RETURN_ERR_IF(*len != 0 && *buf == NULL, EIO);
 	H265_BEGIN_ARRAY(data);
-	for (uint32_t i = 0; i < *len; i++)
-		H265_BITS((*buf)[i], 8);
+	H265_BYTES(*buf, *len);
 	H265_END_ARRAY(data);
 #endif
 
@@ -66,8 +70,7 @@ static int H265_SYNTAX_FCT(sei_user_data_unregistered)(
 	int res = 0;
 
 	H265_BEGIN_ARRAY(uuid);
-	for (uint32_t i = 0; i < 16; i++)
-		H265_BITS(sei->uuid[i], 8);
+	H265_BYTES(sei->uuid, 16);
 	H265_END_ARRAY(uuid);
 
 	res = H265_SYNTAX_FCT(sei_data)(bs, &sei->buf, &sei->len);
@@ -270,6 +273,7 @@ static int H265_SYNTAX_FCT(sei)(struct h265_bitstream *bs,
 #if H265_SYNTAX_OP_KIND == H265_SYNTAX_OP_KIND_READ
 
 	struct h265_bitstream bs2;
+	const uint8_t *payload = NULL;
 	do {
 		H265_BEGIN_ARRAY_ITEM();
 
@@ -285,13 +289,28 @@ static int H265_SYNTAX_FCT(sei)(struct h265_bitstream *bs,
 		sei->type = payload_type;
 
 		/* Setup raw buffer */
-		sei->raw.buf = malloc(payload_size);
-		ULOG_ERRNO_RETURN_ERR_IF(sei->raw.buf == NULL, ENOMEM);
+		ULOG_ERRNO_RETURN_ERR_IF(
+			payload_size > h265_bs_rem_raw_bits(bs) / 8, EIO);
+		sei->raw.buf = NULL;
+		if ((H265_READ_FLAGS() & H265_READER_FLAGS_SEI_NO_COPY) &&
+		    !bs->emulation_prevention && h265_bs_byte_aligned(bs)) {
+			/* Zero-copy view in the NAL unit, if it has no
+			 * emulation prevention byte in the payload */
+			payload = H265_READ_NALU_VIEW(
+				bs->cdata + h265_bs_read_off(bs), payload_size);
+			if (payload != NULL) {
+				res = h265_bs_skip_bytes(bs, payload_size);
+				ULOG_ERRNO_RETURN_ERR_IF(res < 0, -res);
+				sei->raw.buf = (uint8_t *)payload;
+			}
+		}
+		if (sei->raw.buf == NULL) {
+			sei->raw.buf = h265_ctx_sei_alloc(ctx, payload_size);
+			ULOG_ERRNO_RETURN_ERR_IF(sei->raw.buf == NULL, ENOMEM);
+			H265_BYTES(sei->raw.buf, payload_size);
+		}
 		sei->raw.len = payload_size;
 
-		for (uint32_t i = 0; i < sei->raw.len; i++)
-			H265_BITS(sei->raw.buf[i], 8);
-
 		/* Notify callback */
 		H265_CB(ctx,
 			cbs,
@@ -303,10 +322,14 @@ static int H265_SYNTAX_FCT(sei)(struct h265_bitstream *bs,
 
 		/* Construct a bitstream to parse SEI
 		 * (without emulation prevention) */
-		h265_bs_cinit(&bs2, sei->raw.buf, sei->raw.len, 0);
-		res = H265_SYNTAX_FCT(one_sei)(&bs2, ctx, cbs, userdata, sei);
-		h265_bs_clear(&bs2);
-		ULOG_ERRNO_RETURN_ERR_IF(res < 0, -res);
+		if (!(H265_READ_FLAGS() & H265_READER_FLAGS_SKIP_SEI_PAYLOAD)) {
+			h265_bs_cinit(&bs2, sei->raw.buf, sei->raw.len, 0);
+			res = H265_SYNTAX_FCT(one_sei)(
+				&bs2, ctx, cbs, userdata, sei);
+			res = H265_END(&bs2, res);
+			h265_bs_clear(&bs2);
+			ULOG_ERRNO_RETURN_ERR_IF(res < 0, -res);
+		}
 
 		H265_END_ARRAY_ITEM();
 	} while (h265_bs_more_rbsp_data(bs));
@@ -330,8 +353,7 @@ static int H265_SYNTAX_FCT(sei)(struct h265_bitstream *bs,
 		ULOG_ERRNO_RETURN_ERR_IF(res < 0, -res);
 
 		/* Directly write raw buffer, SEI should already be encoded */
-		for (uint32_t i = 0; i < sei->raw.len; i++)
-			H265_BITS(sei->raw.buf[i], 8);
+		H265_BYTES(sei->raw.buf, sei->raw.len);
 
 		H265_END_ARRAY_ITEM();
 	}
@@ -634,6 +656,8 @@ static int H265_SYNTAX_FCT(hrd)(struct h265_bitstream *bs,
 
 		if (!hrd->sub_layers[i].low_delay_hrd_flag)
 			H265_BITS_UE(hrd->sub_layers[i].cpb_cnt_minus1);
+		ULOG_ERRNO_RETURN_ERR_IF(
+			hrd->sub_layers[i].cpb_cnt_minus1 >= CPBS_MAX, EIO);
 
 		if (hrd->nal_hrd_parameters_present_flag) {
 			res = H265_SYNTAX_FCT(sub_layer_hrd)(
@@ -689,6 +713,8 @@ static int H265_SYNTAX_FCT(vps)(struct h265_bitstream *bs, struct h265_vps *vps)
 	H265_BITS(vps->vps_base_layer_available_flag, 1);
 	H265_BITS(vps->vps_max_layers_minus1, 6);
 	H265_BITS(vps->vps_max_sub_layers_minus1, 3);
+	ULOG_ERRNO_RETURN_ERR_IF(
+		vps->vps_max_sub_layers_minus1 >= SUB_LAYERS_MAX, EIO);
 	H265_BITS(vps->vps_temporal_id_nesting_flag, 1);
 	H265_BITS(vps->vps_reserved_0xffff_16bits, 16);
 
@@ -721,6 +747,8 @@ static int H265_SYNTAX_FCT(vps)(struct h265_bitstream *bs, struct h265_vps *vps)
 
 	H265_BITS(vps->vps_max_layer_id, 6);
 	H265_BITS_UE(vps->vps_num_layer_sets_minus1);
+	ULOG_ERRNO_RETURN_ERR_IF(
+		vps->vps_num_layer_sets_minus1 >= LAYER_SETS_MAX, EIO);
 
 	H265_BEGIN_ARRAY(layer_included_flag);
 	for (uint32_t i = 1; i <= vps->vps_num_layer_sets_minus1; ++i) {
@@ -746,6 +774,17 @@ static int H265_SYNTAX_FCT(vps)(struct h265_bitstream *bs, struct h265_vps *vps)
 			H265_BITS_UE(vps->vps_num_ticks_poc_diff_one_minus1);
 
 		H265_BITS_UE(vps->vps_num_hrd_parameters);
+		ULOG_ERRNO_RETURN_ERR_IF(
+			vps->vps_num_hrd_parameters > LAYER_SETS_MAX, EIO);
+
+#if H265_SYNTAX_OP_KIND == H265_SYNTAX_OP_KIND_READ
+		/* Stop here when the HRD parameters are not wanted */
+		if (vps->vps_num_hrd_parameters > 0 &&
+		    (H265_READ_FLAGS() & H265_READER_FLAGS_SKIP_HRD)) {
+			vps->vps_num_hrd_parameters = 0;
+			return 0;
+		}
+#endif
 
 		H265_BEGIN_ARRAY(hrd_layer_set_idx);
 		for (uint32_t i = 0; i < vps->vps_num_hrd_parameters; ++i) {
@@ -823,14 +862,17 @@ static int H265_SYNTAX_FCT(scaling_list_data)(struct h265_bitstream *bs,
 }
 
 
+/**
+ * st_rps is the RPS being processed, either st_rps_table[st_rps_idx] of the
+ * SPS or the RPS of a slice header (st_rps_idx == num_short_ref_pic_sets)
+ */
 static int H265_SYNTAX_FCT(st_ref_pic_set)(
 	struct h265_bitstream *bs,
 	uint32_t st_rps_idx,
 	uint32_t num_short_ref_pic_sets,
-	struct h265_st_ref_pic_set *st_rps_table)
+	const struct h265_st_ref_pic_set *st_rps_table,
+	struct h265_st_ref_pic_set *st_rps)
 {
-	struct h265_st_ref_pic_set *st_rps = &st_rps_table[st_rps_idx];
-
 #if H265_SYNTAX_OP_KIND == H265_SYNTAX_OP_KIND_READ
 	/* Non-zero default values */
 	for (size_t i = 0; i < ARRAY_SIZE(st_rps->use_delta_flag); ++i)
@@ -842,13 +884,15 @@ static int H265_SYNTAX_FCT(st_ref_pic_set)(
 	if (st_rps->inter_ref_pic_set_prediction_flag) {
 		if (st_rps_idx == num_short_ref_pic_sets)
 			H265_BITS_UE(st_rps->delta_idx_minus1);
+		ULOG_ERRNO_RETURN_ERR_IF(st_rps->delta_idx_minus1 >= st_rps_idx,
+					 EIO);
 
 		H265_BITS(st_rps->delta_rps_sign, 1);
 		H265_BITS_UE(st_rps->abs_delta_rps_minus1);
 
 		uint32_t ref_rps_idx =
 			st_rps_idx - (st_rps->delta_idx_minus1 + 1);
-		struct h265_st_ref_pic_set *ref_rps =
+		const struct h265_st_ref_pic_set *ref_rps =
 			&st_rps_table[ref_rps_idx];
 
 		int32_t delta_rps = (1 - 2 * st_rps->delta_rps_sign) *
@@ -934,9 +978,19 @@ static int H265_SYNTAX_FCT(st_ref_pic_set)(
 			}
 		}
 		st_rps->num_positive_pics = i;
+		ULOG_ERRNO_RETURN_ERR_IF(st_rps->num_negative_pics +
+						 st_rps->num_positive_pics >
+					 15,
+					 EIO);
 	} else {
+		/* Both are at most sps_max_dec_pic_buffering_minus1, itself at
+		 * most MaxDpbSize - 1 (A.4.2) */
 		H265_BITS_UE(st_rps->num_negative_pics);
+		ULOG_ERRNO_RETURN_ERR_IF(st_rps->num_negative_pics > 15, EIO);
 		H265_BITS_UE(st_rps->num_positive_pics);
+		ULOG_ERRNO_RETURN_ERR_IF(st_rps->num_positive_pics >
+						 15 - st_rps->num_negative_pics,
+					 EIO);
 
 		H265_BEGIN_ARRAY(negative_pics);
 		for (uint32_t i = 0; i < st_rps->num_negative_pics; ++i) {
@@ -1042,6 +1096,15 @@ static int H265_SYNTAX_FCT(vui)(struct h265_bitstream *bs,
 			H265_BITS_UE(vui->vui_num_ticks_poc_diff_one_minus1);
 
 		H265_BITS(vui->vui_hrd_parameters_present_flag, 1);
+#if H265_SYNTAX_OP_KIND == H265_SYNTAX_OP_KIND_READ
+		/* Stop here when the HRD parameters are not wanted (the
+		 * caller shall not parse the rest of the SPS) */
+		if (vui->vui_hrd_parameters_present_flag &&
+		    (H265_READ_FLAGS() & H265_READER_FLAGS_SKIP_HRD)) {
+			vui->vui_hrd_parameters_present_flag = 0;
+			return 1;
+		}
+#endif
 		if (vui->vui_hrd_parameters_present_flag) {
 			H265_BEGIN_STRUCT(hrd);
 			res = H265_SYNTAX_FCT(hrd)(
@@ -1187,6 +1250,8 @@ static int H265_SYNTAX_FCT(sps_scc_ext)(struct h265_bitstream *bs,
 			  1);
 		if (ext->sps_palette_predictor_initializer_present_flag) {
 			H265_BITS_UE(*num_predictor_alias);
+			ULOG_ERRNO_RETURN_ERR_IF(*num_predictor_alias >= 128,
+						 EIO);
 
 			res = H265_SYNTAX_FCT(scc_comps)(
 				bs,
@@ -1212,6 +1277,8 @@ static int H265_SYNTAX_FCT(sps)(struct h265_bitstream *bs, struct h265_sps *sps)
 
 	H265_BITS(sps->sps_video_parameter_set_id, 4);
 	H265_BITS(sps->sps_max_sub_layers_minus1, 3);
+	ULOG_ERRNO_RETURN_ERR_IF(
+		sps->sps_max_sub_layers_minus1 >= SUB_LAYERS_MAX, EIO);
 	H265_BITS(sps->sps_temporal_id_nesting_flag, 1);
 
 	H265_BEGIN_STRUCT(profile_tier_level);
@@ -1242,8 +1309,12 @@ static int H265_SYNTAX_FCT(sps)(struct h265_bitstream *bs, struct h265_sps *sps)
 	}
 
 	H265_BITS_UE(sps->bit_depth_luma_minus8);
+	ULOG_ERRNO_RETURN_ERR_IF(sps->bit_depth_luma_minus8 > 8, EIO);
 	H265_BITS_UE(sps->bit_depth_chroma_minus8);
+	ULOG_ERRNO_RETURN_ERR_IF(sps->bit_depth_chroma_minus8 > 8, EIO);
 	H265_BITS_UE(sps->log2_max_pic_order_cnt_lsb_minus4);
+	ULOG_ERRNO_RETURN_ERR_IF(sps->log2_max_pic_order_cnt_lsb_minus4 > 12,
+				 EIO);
 	H265_BITS(sps->sps_sub_layer_ordering_info_present_flag, 1);
 
 	uint32_t i = sps->sps_sub_layer_ordering_info_present_flag
@@ -1295,6 +1366,7 @@ static int H265_SYNTAX_FCT(sps)(struct h265_bitstream *bs, struct h265_sps *sps)
 	}
 
 	H265_BITS_UE(sps->num_short_term_ref_pic_sets);
+	ULOG_ERRNO_RETURN_ERR_IF(sps->num_short_term_ref_pic_sets > 64, EIO);
 
 	H265_BEGIN_ARRAY(st_ref_pic_sets);
 	for (uint32_t i = 0; i < sps->num_short_term_ref_pic_sets; ++i) {
@@ -1305,7 +1377,8 @@ static int H265_SYNTAX_FCT(sps)(struct h265_bitstream *bs, struct h265_sps *sps)
 			bs,
 			i,
 			sps->num_short_term_ref_pic_sets,
-			sps->st_ref_pic_sets);
+			sps->st_ref_pic_sets,
+			&sps->st_ref_pic_sets[i]);
 		H265_END_STRUCT(st_ref_pic_set);
 
 		ULOG_ERRNO_RETURN_ERR_IF(res < 0, -res);
@@ -1317,6 +1390,8 @@ static int H265_SYNTAX_FCT(sps)(struct h265_bitstream *bs, struct h265_sps *sps)
 	H265_BITS(sps->long_term_ref_pics_present_flag, 1);
 	if (sps->long_term_ref_pics_present_flag) {
 		H265_BITS_UE(sps->num_long_term_ref_pics_sps);
+		ULOG_ERRNO_RETURN_ERR_IF(sps->num_long_term_ref_pics_sps > 32,
+					 EIO);
 
 		H265_BEGIN_ARRAY(long_term_ref_pics_sps);
 		for (uint32_t i = 0; i < sps->num_long_term_ref_pics_sps; ++i) {
@@ -1339,6 +1414,14 @@ static int H265_SYNTAX_FCT(sps)(struct h265_bitstream *bs, struct h265_sps *sps)
 	H265_BITS(sps->strong_intra_smoothing_enabled_flag, 1);
 
 	H265_BITS(sps->vui_parameters_present_flag, 1);
+#if H265_SYNTAX_OP_KIND == H265_SYNTAX_OP_KIND_READ
+	/* Stop here when the VUI is not wanted */
+	if (sps->vui_parameters_present_flag &&
+	    (H265_READ_FLAGS() & H265_READER_FLAGS_SKIP_VUI)) {
+		sps->vui_parameters_present_flag = 0;
+		return 0;
+	}
+#endif
 	if (sps->vui_parameters_present_flag) {
 		H265_BEGIN_STRUCT(vui);
 		res = H265_SYNTAX_FCT(vui)(
@@ -1346,6 +1429,10 @@ static int H265_SYNTAX_FCT(sps)(struct h265_bitstream *bs, struct h265_sps *sps)
 		H265_END_STRUCT(vui);
 
 		ULOG_ERRNO_RETURN_ERR_IF(res < 0, -res);
+
+		/* Parsing stopped at the HRD parameters */
+		if (res > 0)
+			return 0;
 	}
 
 	H265_BITS(sps->sps_extension_present_flag, 1);
@@ -1528,6 +1615,8 @@ static int H265_SYNTAX_FCT(pps_range_ext)(struct h265_bitstream *bs,
 		H265_BITS_UE(ext->diff_cu_chroma_qp_offset_depth);
 
 		H265_BITS_UE(ext->chroma_qp_offset_list_len_minus1);
+		ULOG_ERRNO_RETURN_ERR_IF(
+			ext->chroma_qp_offset_list_len_minus1 > 5, EIO);
 		for (uint32_t i = 0; i < ext->chroma_qp_offset_list_len_minus1;
 		     ++i) {
 			H265_BITS_SE(ext->cb_qp_offset_list[i]);
@@ -1547,9 +1636,11 @@ static int H265_SYNTAX_FCT(pps_palette)(struct h265_bitstream *bs,
 {
 	H265_BITS(ext->monochrome_palette_flag, 1);
 	H265_BITS_UE(ext->luma_bit_depth_entry_minus8);
+	ULOG_ERRNO_RETURN_ERR_IF(ext->luma_bit_depth_entry_minus8 > 8, EIO);
 
 	if (!ext->monochrome_palette_flag)
 		H265_BITS_UE(ext->chroma_bit_depth_entry_minus8);
+	ULOG_ERRNO_RETURN_ERR_IF(ext->chroma_bit_depth_entry_minus8 > 8, EIO);
 
 	uint32_t num_comps = ext->monochrome_palette_flag ? 1 : 3;
 
@@ -1604,6 +1695,8 @@ static int H265_SYNTAX_FCT(pps_scc_ext)(struct h265_bitstream *bs,
 	H265_BITS(ext->pps_palette_predictor_initializers_present_flag, 1);
 	if (ext->pps_palette_predictor_initializers_present_flag) {
 		H265_BITS_UE(ext->pps_num_palette_predictor_initializers);
+		ULOG_ERRNO_RETURN_ERR_IF(
+			ext->pps_num_palette_predictor_initializers > 128, EIO);
 		if (ext->pps_num_palette_predictor_initializers > 0) {
 			res = H265_SYNTAX_FCT(pps_palette)(bs, ext);
 
@@ -1652,9 +1745,15 @@ static int H265_SYNTAX_FCT(pps)(struct h265_bitstream *bs, struct h265_pps *pps)
 	H265_BITS(pps->entropy_coding_sync_enabled_flag, 1);
 
 	if (pps->tiles_enabled_flag) {
+		/* Both are lower than the picture size in CTBs, itself lower
+		 * than H265_TILES_MAX for all the levels of Annex A */
 		H265_BITS_UE(pps->num_tile_columns_minus1);
+		ULOG_ERRNO_RETURN_ERR_IF(
+			pps->num_tile_columns_minus1 >= H265_TILES_MAX, EIO);
 
 		H265_BITS_UE(pps->num_tile_rows_minus1);
+		ULOG_ERRNO_RETURN_ERR_IF(
+			pps->num_tile_rows_minus1 >= H265_TILES_MAX, EIO);
 
 #if H265_SYNTAX_OP_KIND == H265_SYNTAX_OP_KIND_READ
 		pps->column_width_minus1 =
@@ -1776,6 +1875,638 @@ static int H265_SYNTAX_FCT(pps)(struct h265_bitstream *bs, struct h265_pps *pps)
 }
 
 
+/**
+ * 7.4.7.1 Equation (7-55), st_rps being the RPS of the current picture or
+ * NULL for an IDR picture
+ */
+static uint32_t
+get_num_pic_total_curr(const struct h265_sps *sps,
+		       const struct h265_pps *pps,
+		       const struct h265_slice_header *sh,
+		       const struct h265_st_ref_pic_set *st_rps)
+{
+	uint32_t n = 0;
+
+	if (st_rps != NULL) {
+		for (uint32_t i = 0; i < st_rps->num_negative_pics; ++i)
+			n += st_rps->used_by_curr_pic_s0_flag[i] ? 1 : 0;
+		for (uint32_t i = 0; i < st_rps->num_positive_pics; ++i)
+			n += st_rps->used_by_curr_pic_s1_flag[i] ? 1 : 0;
+		for (uint32_t i = 0;
+		     i < sh->num_long_term_sps + sh->num_long_term_pics;
+		     ++i) {
+			int used = (i < sh->num_long_term_sps)
+					   ? sps->used_by_curr_pic_lt_sps_flag
+						     [sh->lt_idx_sps[i]]
+					   : sh->used_by_curr_pic_lt_flag[i];
+			n += used ? 1 : 0;
+		}
+	}
+	if (pps->pps_scc_ext.pps_curr_pic_ref_enabled_flag)
+		n++;
+
+	return n;
+}
+
+
+/**
+ * 8.3.4: whether RefPicList0[i] is the current picture, which is only
+ * possible if pps_curr_pic_ref_enabled_flag is 1. RefPicListTemp0 repeats
+ * the reference pictures of the RPS followed by the current picture, i.e.
+ * NumPicTotalCurr pictures.
+ */
+static int is_curr_pic_ref_l0(const struct h265_pps *pps,
+			      const struct h265_slice_header *sh,
+			      uint32_t num_pic_total_curr,
+			      uint32_t i)
+{
+	const struct h265_ref_pic_lists_modification *rplm =
+		&sh->ref_pic_lists_modification;
+	uint32_t num_active = sh->num_ref_idx_l0_active_minus1 + 1;
+	uint32_t r_idx = i;
+
+	if (!pps->pps_scc_ext.pps_curr_pic_ref_enabled_flag)
+		return 0;
+
+	if (rplm->ref_pic_list_modification_flag_l0)
+		r_idx = rplm->list_entry_l0[i];
+	else if (i == num_active - 1 && num_pic_total_curr > num_active)
+		return 1;
+
+	return r_idx % num_pic_total_curr == num_pic_total_curr - 1;
+}
+
+
+#if H265_SYNTAX_OP_KIND == H265_SYNTAX_OP_KIND_READ
+/**
+ * Reset the fields of an independent slice segment header following
+ * slice_segment_address, using the inferred values when not present
+ * (7.4.7.1)
+ */
+static void slice_header_reset(struct h265_slice_header *sh,
+			       const struct h265_pps *pps)
+{
+	int first_slice_segment_in_pic_flag =
+		sh->first_slice_segment_in_pic_flag;
+	int no_output_of_prior_pics_flag = sh->no_output_of_prior_pics_flag;
+	uint32_t slice_pic_parameter_set_id = sh->slice_pic_parameter_set_id;
+	uint32_t slice_segment_address = sh->slice_segment_address;
+	uint32_t *entry_point_offset_minus1 = sh->entry_point_offset_minus1;
+
+	memset(sh, 0, sizeof(*sh));
+	sh->first_slice_segment_in_pic_flag = first_slice_segment_in_pic_flag;
+	sh->no_output_of_prior_pics_flag = no_output_of_prior_pics_flag;
+	sh->slice_pic_parameter_set_id = slice_pic_parameter_set_id;
+	sh->slice_segment_address = slice_segment_address;
+	sh->entry_point_offset_minus1 = entry_point_offset_minus1;
+
+	/* Fields with non-zero default values */
+	sh->pic_output_flag = 1;
+	sh->num_ref_idx_l0_active_minus1 =
+		pps->num_ref_idx_l0_default_active_minus1;
+	sh->num_ref_idx_l1_active_minus1 =
+		pps->num_ref_idx_l1_default_active_minus1;
+	sh->collocated_from_l0_flag = 1;
+	sh->slice_deblocking_filter_disabled_flag =
+		pps->pps_deblocking_filter_disabled_flag;
+	sh->slice_beta_offset_div2 = pps->pps_beta_offset_div2;
+	sh->slice_tc_offset_div2 = pps->pps_tc_offset_div2;
+	sh->slice_loop_filter_across_slices_enabled_flag =
+		pps->pps_loop_filter_across_slices_enabled_flag;
+}
+#endif
+
+
+static int H265_SYNTAX_FCT(ref_pic_lists_modification)(
+	struct h265_bitstream *bs,
+	const struct h265_slice_header *sh,
+	uint32_t num_pic_total_curr,
+	struct h265_ref_pic_lists_modification *rplm)
+{
+	H265_BITS(rplm->ref_pic_list_modification_flag_l0, 1);
+	if (rplm->ref_pic_list_modification_flag_l0) {
+		H265_BEGIN_ARRAY(list_entries_l0);
+		for (uint32_t i = 0; i <= sh->num_ref_idx_l0_active_minus1;
+		     ++i) {
+			H265_BEGIN_ARRAY_ITEM();
+
+			H265_BITS(rplm->list_entry_l0[i],
+				  h265_ceil_log2(num_pic_total_curr));
+			ULOG_ERRNO_RETURN_ERR_IF(
+				rplm->list_entry_l0[i] >= num_pic_total_curr,
+				EIO);
+
+			H265_END_ARRAY_ITEM();
+		}
+		H265_END_ARRAY(list_entries_l0);
+	}
+
+	if (sh->slice_type != H265_SLICE_TYPE_B)
+		return 0;
+
+	H265_BITS(rplm->ref_pic_list_modification_flag_l1, 1);
+	if (rplm->ref_pic_list_modification_flag_l1) {
+		H265_BEGIN_ARRAY(list_entries_l1);
+		for (uint32_t i = 0; i <= sh->num_ref_idx_l1_active_minus1;
+		     ++i) {
+			H265_BEGIN_ARRAY_ITEM();
+
+			H265_BITS(rplm->list_entry_l1[i],
+				  h265_ceil_log2(num_pic_total_curr));
+			ULOG_ERRNO_RETURN_ERR_IF(
+				rplm->list_entry_l1[i] >= num_pic_total_curr,
+				EIO);
+
+			H265_END_ARRAY_ITEM();
+		}
+		H265_END_ARRAY(list_entries_l1);
+	}
+
+	return 0;
+}
+
+
+static int H265_SYNTAX_FCT(pred_weight_table)(
+	struct h265_bitstream *bs,
+	const struct h265_pps *pps,
+	const struct h265_slice_header *sh,
+	uint32_t chroma_array_type,
+	uint32_t num_pic_total_curr,
+	struct h265_pred_weight_table *pwt)
+{
+	H265_BITS_UE(pwt->luma_log2_weight_denom);
+	if (chroma_array_type != 0)
+		H265_BITS_SE(pwt->delta_chroma_log2_weight_denom);
+
+	/* The weight flags are not present for the current picture used as
+	 * a reference picture (single layer) */
+	H265_BEGIN_ARRAY(luma_weight_l0_flags);
+	for (uint32_t i = 0; i <= sh->num_ref_idx_l0_active_minus1; ++i) {
+		H265_BEGIN_ARRAY_ITEM();
+		if (!is_curr_pic_ref_l0(pps, sh, num_pic_total_curr, i))
+			H265_BITS(pwt->luma_weight_l0_flag[i], 1);
+		H265_END_ARRAY_ITEM();
+	}
+	H265_END_ARRAY(luma_weight_l0_flags);
+
+	if (chroma_array_type != 0) {
+		H265_BEGIN_ARRAY(chroma_weight_l0_flags);
+		for (uint32_t i = 0; i <= sh->num_ref_idx_l0_active_minus1;
+		     ++i) {
+			H265_BEGIN_ARRAY_ITEM();
+			if (!is_curr_pic_ref_l0(
+				    pps, sh, num_pic_total_curr, i))
+				H265_BITS(pwt->chroma_weight_l0_flag[i], 1);
+			H265_END_ARRAY_ITEM();
+		}
+		H265_END_ARRAY(chroma_weight_l0_flags);
+	}
+
+	H265_BEGIN_ARRAY(weights_l0);
+	for (uint32_t i = 0; i <= sh->num_ref_idx_l0_active_minus1; ++i) {
+		H265_BEGIN_ARRAY_ITEM();
+
+		if (pwt->luma_weight_l0_flag[i]) {
+			H265_BITS_SE(pwt->delta_luma_weight_l0[i]);
+			H265_BITS_SE(pwt->luma_offset_l0[i]);
+		}
+		if (pwt->chroma_weight_l0_flag[i]) {
+			H265_BEGIN_ARRAY(chroma);
+			for (uint32_t j = 0; j < 2; ++j) {
+				H265_BEGIN_ARRAY_ITEM();
+				H265_BITS_SE(pwt->delta_chroma_weight_l0[i][j]);
+				H265_BITS_SE(pwt->delta_chroma_offset_l0[i][j]);
+				H265_END_ARRAY_ITEM();
+			}
+			H265_END_ARRAY(chroma);
+		}
+
+		H265_END_ARRAY_ITEM();
+	}
+	H265_END_ARRAY(weights_l0);
+
+	if (sh->slice_type != H265_SLICE_TYPE_B)
+		return 0;
+
+	H265_BEGIN_ARRAY(luma_weight_l1_flags);
+	for (uint32_t i = 0; i <= sh->num_ref_idx_l1_active_minus1; ++i) {
+		H265_BEGIN_ARRAY_ITEM();
+		H265_BITS(pwt->luma_weight_l1_flag[i], 1);
+		H265_END_ARRAY_ITEM();
+	}
+	H265_END_ARRAY(luma_weight_l1_flags);
+
+	if (chroma_array_type != 0) {
+		H265_BEGIN_ARRAY(chroma_weight_l1_flags);
+		for (uint32_t i = 0; i <= sh->num_ref_idx_l1_active_minus1;
+		     ++i) {
+			H265_BEGIN_ARRAY_ITEM();
+			H265_BITS(pwt->chroma_weight_l1_flag[i], 1);
+			H265_END_ARRAY_ITEM();
+		}
+		H265_END_ARRAY(chroma_weight_l1_flags);
+	}
+
+	H265_BEGIN_ARRAY(weights_l1);
+	for (uint32_t i = 0; i <= sh->num_ref_idx_l1_active_minus1; ++i) {
+		H265_BEGIN_ARRAY_ITEM();
+
+		if (pwt->luma_weight_l1_flag[i]) {
+			H265_BITS_SE(pwt->delta_luma_weight_l1[i]);
+			H265_BITS_SE(pwt->luma_offset_l1[i]);
+		}
+		if (pwt->chroma_weight_l1_flag[i]) {
+			H265_BEGIN_ARRAY(chroma);
+			for (uint32_t j = 0; j < 2; ++j) {
+				H265_BEGIN_ARRAY_ITEM();
+				H265_BITS_SE(pwt->delta_chroma_weight_l1[i][j]);
+				H265_BITS_SE(pwt->delta_chroma_offset_l1[i][j]);
+				H265_END_ARRAY_ITEM();
+			}
+			H265_END_ARRAY(chroma);
+		}
+
+		H265_END_ARRAY_ITEM();
+	}
+	H265_END_ARRAY(weights_l1);
+
+	return 0;
+}
+
+
+/**
+ * Fields of the slice segment header only present in independent slice
+ * segments
+ */
+static int H265_SYNTAX_FCT(independent_slice_header)(
+	struct h265_bitstream *bs,
+	const struct h265_nalu_header *header,
+	const struct h265_sps *sps,
+	const struct h265_pps *pps,
+	struct h265_slice_header *sh)
+{
+	int res = 0;
+	uint32_t type = header->nal_unit_type;
+	uint32_t chroma_array_type =
+		sps->separate_colour_plane_flag ? 0 : sps->chroma_format_idc;
+	const struct h265_st_ref_pic_set *st_rps = NULL;
+	uint32_t num_pic_total_curr = 0;
+
+	H265_BEGIN_ARRAY(slice_reserved_flags);
+	for (uint32_t i = 0; i < pps->num_extra_slice_header_bits; ++i) {
+		H265_BEGIN_ARRAY_ITEM();
+		H265_BITS(sh->slice_reserved_flag[i], 1);
+		H265_END_ARRAY_ITEM();
+	}
+	H265_END_ARRAY(slice_reserved_flags);
+
+	H265_BITS_UE(sh->slice_type);
+	ULOG_ERRNO_RETURN_ERR_IF(sh->slice_type > H265_SLICE_TYPE_I, EIO);
+
+	if (pps->output_flag_present_flag)
+		H265_BITS(sh->pic_output_flag, 1);
+
+	if (sps->separate_colour_plane_flag)
+		H265_BITS(sh->colour_plane_id, 2);
+
+	if (type != H265_NALU_TYPE_IDR_W_RADL &&
+	    type != H265_NALU_TYPE_IDR_N_LP) {
+		H265_BITS(sh->slice_pic_order_cnt_lsb,
+			  sps->log2_max_pic_order_cnt_lsb_minus4 + 4);
+
+		H265_BITS(sh->short_term_ref_pic_set_sps_flag, 1);
+		if (!sh->short_term_ref_pic_set_sps_flag) {
+			H265_BEGIN_STRUCT(st_ref_pic_set);
+			res = H265_SYNTAX_FCT(st_ref_pic_set)(
+				bs,
+				sps->num_short_term_ref_pic_sets,
+				sps->num_short_term_ref_pic_sets,
+				sps->st_ref_pic_sets,
+				&sh->st_ref_pic_set);
+			H265_END_STRUCT(st_ref_pic_set);
+
+			ULOG_ERRNO_RETURN_ERR_IF(res < 0, -res);
+
+			st_rps = &sh->st_ref_pic_set;
+		} else {
+			uint32_t num = sps->num_short_term_ref_pic_sets;
+
+			if (num > 1)
+				H265_BITS(sh->short_term_ref_pic_set_idx,
+					  h265_ceil_log2(num));
+			ULOG_ERRNO_RETURN_ERR_IF(
+				sh->short_term_ref_pic_set_idx >= num, EIO);
+
+			st_rps = &sps->st_ref_pic_sets
+					  [sh->short_term_ref_pic_set_idx];
+		}
+
+		if (sps->long_term_ref_pics_present_flag) {
+			uint32_t num_lt_sps = sps->num_long_term_ref_pics_sps;
+
+			if (num_lt_sps > 0)
+				H265_BITS_UE(sh->num_long_term_sps);
+			ULOG_ERRNO_RETURN_ERR_IF(
+				sh->num_long_term_sps > num_lt_sps, EIO);
+
+			H265_BITS_UE(sh->num_long_term_pics);
+			uint32_t max_lt_pics = 32 - sh->num_long_term_sps;
+			ULOG_ERRNO_RETURN_ERR_IF(
+				sh->num_long_term_pics > max_lt_pics, EIO);
+
+#if H265_SYNTAX_OP_KIND != H265_SYNTAX_OP_KIND_DUMP
+			uint32_t lt_idx_bits = h265_ceil_log2(num_lt_sps);
+			uint32_t poc_lsb_bits =
+				sps->log2_max_pic_order_cnt_lsb_minus4 + 4;
+#endif
+
+			H265_BEGIN_ARRAY(long_term_pics);
+			for (uint32_t i = 0; i < sh->num_long_term_sps +
+							 sh->num_long_term_pics;
+			     ++i) {
+				H265_BEGIN_ARRAY_ITEM();
+
+				if (i < sh->num_long_term_sps) {
+					if (num_lt_sps > 1)
+						H265_BITS(sh->lt_idx_sps[i],
+							  lt_idx_bits);
+					ULOG_ERRNO_RETURN_ERR_IF(
+						sh->lt_idx_sps[i] >= num_lt_sps,
+						EIO);
+				} else {
+					H265_BITS(sh->poc_lsb_lt[i],
+						  poc_lsb_bits);
+					H265_BITS(
+						sh->used_by_curr_pic_lt_flag[i],
+						1);
+				}
+
+				H265_BITS(sh->delta_poc_msb_present_flag[i], 1);
+				if (sh->delta_poc_msb_present_flag[i])
+					H265_BITS_UE(
+						sh->delta_poc_msb_cycle_lt[i]);
+
+				H265_END_ARRAY_ITEM();
+			}
+			H265_END_ARRAY(long_term_pics);
+		}
+
+		if (sps->sps_temporal_mvp_enabled_flag)
+			H265_BITS(sh->slice_temporal_mvp_enabled_flag, 1);
+	}
+
+	num_pic_total_curr = get_num_pic_total_curr(sps, pps, sh, st_rps);
+
+	if (sps->sample_adaptive_offset_enabled_flag) {
+		H265_BITS(sh->slice_sao_luma_flag, 1);
+		if (chroma_array_type != 0)
+			H265_BITS(sh->slice_sao_chroma_flag, 1);
+	}
+
+	if (sh->slice_type == H265_SLICE_TYPE_P ||
+	    sh->slice_type == H265_SLICE_TYPE_B) {
+		H265_BITS(sh->num_ref_idx_active_override_flag, 1);
+		if (sh->num_ref_idx_active_override_flag) {
+			H265_BITS_UE(sh->num_ref_idx_l0_active_minus1);
+			if (sh->slice_type == H265_SLICE_TYPE_B)
+				H265_BITS_UE(sh->num_ref_idx_l1_active_minus1);
+		}
+		ULOG_ERRNO_RETURN_ERR_IF(
+			sh->num_ref_idx_l0_active_minus1 >= REF_IDX_MAX, EIO);
+		ULOG_ERRNO_RETURN_ERR_IF(
+			sh->slice_type == H265_SLICE_TYPE_B &&
+				sh->num_ref_idx_l1_active_minus1 >= REF_IDX_MAX,
+			EIO);
+
+		if (pps->lists_modification_present_flag &&
+		    num_pic_total_curr > 1) {
+			H265_BEGIN_STRUCT(ref_pic_lists_modification);
+			res = H265_SYNTAX_FCT(ref_pic_lists_modification)(
+				bs,
+				sh,
+				num_pic_total_curr,
+				&sh->ref_pic_lists_modification);
+			H265_END_STRUCT(ref_pic_lists_modification);
+
+			ULOG_ERRNO_RETURN_ERR_IF(res < 0, -res);
+		}
+
+		if (sh->slice_type == H265_SLICE_TYPE_B)
+			H265_BITS(sh->mvd_l1_zero_flag, 1);
+
+		if (pps->cabac_init_present_flag)
+			H265_BITS(sh->cabac_init_flag, 1);
+
+		if (sh->slice_temporal_mvp_enabled_flag) {
+			if (sh->slice_type == H265_SLICE_TYPE_B)
+				H265_BITS(sh->collocated_from_l0_flag, 1);
+			if ((sh->collocated_from_l0_flag &&
+			     sh->num_ref_idx_l0_active_minus1 > 0) ||
+			    (!sh->collocated_from_l0_flag &&
+			     sh->num_ref_idx_l1_active_minus1 > 0))
+				H265_BITS_UE(sh->collocated_ref_idx);
+		}
+
+		if ((pps->weighted_pred_flag &&
+		     sh->slice_type == H265_SLICE_TYPE_P) ||
+		    (pps->weighted_bipred_flag &&
+		     sh->slice_type == H265_SLICE_TYPE_B)) {
+			H265_BEGIN_STRUCT(pred_weight_table);
+			res = H265_SYNTAX_FCT(pred_weight_table)(
+				bs,
+				pps,
+				sh,
+				chroma_array_type,
+				num_pic_total_curr,
+				&sh->pred_weight_table);
+			H265_END_STRUCT(pred_weight_table);
+
+			ULOG_ERRNO_RETURN_ERR_IF(res < 0, -res);
+		}
+
+		H265_BITS_UE(sh->five_minus_max_num_merge_cand);
+
+		if (sps->sps_scc_ext.motion_vector_resolution_control_idc == 2)
+			H265_BITS(sh->use_integer_mv_flag, 1);
+	}
+
+	H265_BITS_SE(sh->slice_qp_delta);
+
+	if (pps->pps_slice_chroma_qp_offsets_present_flag) {
+		H265_BITS_SE(sh->slice_cb_qp_offset);
+		H265_BITS_SE(sh->slice_cr_qp_offset);
+	}
+
+	if (pps->pps_scc_ext.pps_slice_act_qp_offsets_present_flag) {
+		H265_BITS_SE(sh->slice_act_y_qp_offset);
+		H265_BITS_SE(sh->slice_act_cb_qp_offset);
+		H265_BITS_SE(sh->slice_act_cr_qp_offset);
+	}
+
+	if (pps->pps_range_ext.chroma_qp_offset_list_enabled_flag)
+		H265_BITS(sh->cu_chroma_qp_offset_enabled_flag, 1);
+
+	if (pps->deblocking_filter_override_enabled_flag)
+		H265_BITS(sh->deblocking_filter_override_flag, 1);
+
+	if (sh->deblocking_filter_override_flag) {
+		H265_BITS(sh->slice_deblocking_filter_disabled_flag, 1);
+		if (!sh->slice_deblocking_filter_disabled_flag) {
+			H265_BITS_SE(sh->slice_beta_offset_div2);
+			H265_BITS_SE(sh->slice_tc_offset_div2);
+		}
+	}
+
+	if (pps->pps_loop_filter_across_slices_enabled_flag &&
+	    (sh->slice_sao_luma_flag || sh->slice_sao_chroma_flag ||
+	     !sh->slice_deblocking_filter_disabled_flag))
+		H265_BITS(sh->slice_loop_filter_across_slices_enabled_flag, 1);
+
+	return 0;
+}
+
+
+/**
+ * 7.3.6.1 General slice segment header syntax
+ *
+ * @return -ENOENT if the PPS of the slice segment or its SPS is not known
+ */
+static int H265_SYNTAX_FCT(slice_header)(struct h265_bitstream *bs,
+					 struct h265_ctx *ctx,
+					 const struct h265_nalu_header *header,
+					 struct h265_slice_header *sh)
+{
+	int res = 0;
+	uint32_t type = header->nal_unit_type;
+	const struct h265_pps *pps = NULL;
+	const struct h265_sps *sps = NULL;
+
+#if H265_SYNTAX_OP_KIND == H265_SYNTAX_OP_KIND_READ
+	/* Fields of the slice segment not always present, the other ones are
+	 * reset for independent slice segments only */
+	sh->no_output_of_prior_pics_flag = 0;
+	sh->dependent_slice_segment_flag = 0;
+	sh->slice_segment_address = 0;
+	sh->num_entry_point_offsets = 0;
+	sh->offset_len_minus1 = 0;
+	sh->slice_segment_header_extension_length = 0;
+#endif
+
+	H265_BITS(sh->first_slice_segment_in_pic_flag, 1);
+	if (type >= H265_NALU_TYPE_BLA_W_LP &&
+	    type <= H265_NALU_TYPE_RSV_IRAP_VCL23)
+		H265_BITS(sh->no_output_of_prior_pics_flag, 1);
+	H265_BITS_UE(sh->slice_pic_parameter_set_id);
+
+	if (sh->slice_pic_parameter_set_id < ARRAY_SIZE(ctx->pps_table))
+		pps = ctx->pps_table[sh->slice_pic_parameter_set_id];
+	if (pps != NULL &&
+	    pps->pps_seq_parameter_set_id < ARRAY_SIZE(ctx->sps_table))
+		sps = ctx->sps_table[pps->pps_seq_parameter_set_id];
+	if (pps == NULL || sps == NULL)
+		return -ENOENT;
+
+	/* CtbLog2SizeY is at most 6 for all the profiles of Annex A; the
+	 * picture size in CTBs is then lower than 2^32 for all the levels */
+	uint64_t ctb_log2_size =
+		(uint64_t)sps->log2_min_luma_coding_block_size_minus3 + 3 +
+		sps->log2_diff_max_min_luma_coding_block_size;
+	ULOG_ERRNO_RETURN_ERR_IF(ctb_log2_size > 6, EIO);
+	uint64_t ctb_size = UINT64_C(1) << ctb_log2_size;
+	uint64_t pic_width_in_ctbs =
+		(sps->pic_width_in_luma_samples + ctb_size - 1) / ctb_size;
+	uint64_t pic_height_in_ctbs =
+		(sps->pic_height_in_luma_samples + ctb_size - 1) / ctb_size;
+	uint64_t pic_size_in_ctbs = pic_width_in_ctbs * pic_height_in_ctbs;
+	ULOG_ERRNO_RETURN_ERR_IF(pic_size_in_ctbs > UINT32_MAX, EIO);
+
+	if (!sh->first_slice_segment_in_pic_flag) {
+		if (pps->dependent_slice_segments_enabled_flag)
+			H265_BITS(sh->dependent_slice_segment_flag, 1);
+		H265_BITS(sh->slice_segment_address,
+			  h265_ceil_log2(pic_size_in_ctbs));
+		ULOG_ERRNO_RETURN_ERR_IF(
+			sh->slice_segment_address >= pic_size_in_ctbs, EIO);
+	}
+
+	if (!sh->dependent_slice_segment_flag) {
+#if H265_SYNTAX_OP_KIND == H265_SYNTAX_OP_KIND_READ
+		slice_header_reset(sh, pps);
+#endif
+		res = H265_SYNTAX_FCT(independent_slice_header)(
+			bs, header, sps, pps, sh);
+		ULOG_ERRNO_RETURN_ERR_IF(res < 0, -res);
+	}
+
+	if (pps->tiles_enabled_flag || pps->entropy_coding_sync_enabled_flag) {
+		/* 7.4.7.1: at most one entry point per tile and/or CTB row */
+		uint64_t max_entry_points = pic_height_in_ctbs;
+		if (pps->tiles_enabled_flag)
+			max_entry_points =
+				(pps->num_tile_columns_minus1 + 1) *
+				(pps->entropy_coding_sync_enabled_flag
+					 ? pic_height_in_ctbs
+					 : pps->num_tile_rows_minus1 + 1);
+
+		H265_BITS_UE(sh->num_entry_point_offsets);
+		ULOG_ERRNO_RETURN_ERR_IF(
+			sh->num_entry_point_offsets >= max_entry_points, EIO);
+
+		if (sh->num_entry_point_offsets > 0) {
+			H265_BITS_UE(sh->offset_len_minus1);
+			ULOG_ERRNO_RETURN_ERR_IF(sh->offset_len_minus1 > 31,
+						 EIO);
+
+#if H265_SYNTAX_OP_KIND == H265_SYNTAX_OP_KIND_READ
+			/* Each entry point takes at least one bit */
+			size_t rem_bits = h265_bs_rem_raw_bits(bs);
+			ULOG_ERRNO_RETURN_ERR_IF(
+				sh->num_entry_point_offsets > rem_bits, EIO);
+			sh->entry_point_offset_minus1 =
+				h265_ctx_alloc_entry_points(
+					ctx, sh->num_entry_point_offsets);
+			ULOG_ERRNO_RETURN_ERR_IF(
+				sh->entry_point_offset_minus1 == NULL, ENOMEM);
+#endif
+
+			H265_BEGIN_ARRAY(entry_points);
+			for (uint32_t i = 0; i < sh->num_entry_point_offsets;
+			     ++i) {
+				H265_BEGIN_ARRAY_ITEM();
+				H265_BITS(sh->entry_point_offset_minus1[i],
+					  sh->offset_len_minus1 + 1);
+				H265_END_ARRAY_ITEM();
+			}
+			H265_END_ARRAY(entry_points);
+		}
+	}
+
+	if (pps->slice_segment_header_extension_present_flag) {
+		H265_BITS_UE(sh->slice_segment_header_extension_length);
+		ULOG_ERRNO_RETURN_ERR_IF(
+			sh->slice_segment_header_extension_length > 256, EIO);
+
+		H265_BEGIN_ARRAY(slice_segment_header_extension_data);
+		for (uint32_t i = 0;
+		     i < sh->slice_segment_header_extension_length;
+		     ++i) {
+			H265_BEGIN_ARRAY_ITEM();
+			H265_BITS(sh->slice_segment_header_extension_data_byte
+					  [i],
+				  8);
+			H265_END_ARRAY_ITEM();
+		}
+		H265_END_ARRAY(slice_segment_header_extension_data);
+	}
+
+	/* byte_alignment() (7.3.2.12) has the same syntax as
+	 * rbsp_trailing_bits(): a bit equal to 1 followed by zero bits */
+	H265_BITS_RBSP_TRAILING();
+
+	return 0;
+}
+
+
 /**
  * 7.4.2.2
  * Table 7 - 1
@@ -1837,18 +2568,23 @@ static int H265_SYNTAX_FCT(nalu)(struct h265_bitstream *bs,
 
 	const uint8_t *buf = NULL;
 	size_t len = 0;
+#if H265_SYNTAX_OP_KIND == H265_SYNTAX_OP_KIND_READ
+	uint32_t changes = 0;
+	const struct h265_slice_header *sh = NULL;
+#endif
 
 	ctx->nalu_unknown = 0;
+	ctx->ps_unchanged = 0;
 
 #if H265_SYNTAX_OP_KIND == H265_SYNTAX_OP_KIND_READ
-	buf = bs->cdata + bs->off;
-	len = bs->len;
+	buf = H265_READ_NALU_BUF();
+	len = H265_READ_NALU_LEN();
 	res = h265_ctx_clear_nalu(ctx);
 	ULOG_ERRNO_RETURN_ERR_IF(res < 0, -res);
 #endif
 
 	H265_BEGIN_STRUCT(nalu_header);
-	res = H265_SYNTAX_FCT(nalu_header)(bs, header);
+	res = H265_END(bs, H265_SYNTAX_FCT(nalu_header)(bs, header));
 	H265_END_STRUCT(nalu_header);
 
 	ULOG_ERRNO_RETURN_ERR_IF(res < 0, -res);
@@ -1862,113 +2598,140 @@ static int H265_SYNTAX_FCT(nalu)(struct h265_bitstream *bs,
 		len,
 		&ctx->nalu_header);
 
+#if H265_SYNTAX_OP_KIND == H265_SYNTAX_OP_KIND_READ
+	/* Selective parsing, see h265_reader_nalu_header_only() */
+	if (h265_reader_nalu_header_only(H265_READ_FLAGS(),
+					 header->nal_unit_type))
+		goto nalu_end;
+#endif
+
 	switch (header->nal_unit_type) {
 	case H265_NALU_TYPE_VPS_NUT: {
 #if H265_SYNTAX_OP_KIND == H265_SYNTAX_OP_KIND_READ
-		struct h265_vps *vps = calloc(1, sizeof(*vps));
-		ULOG_ERRNO_RETURN_ERR_IF(vps == NULL, ENOMEM);
+		/* Repeated VPS: reuse the stored one, see h265_ctx_reuse_ps() */
+		if (!h265_ctx_reuse_ps(ctx,
+				       header->nal_unit_type,
+				       buf,
+				       len,
+				       H265_READ_FLAGS())) {
+			res = h265_ctx_set_ps_from_nalu(ctx,
+							bs,
+							header->nal_unit_type,
+							buf,
+							len,
+							H265_READ_FLAGS(),
+							&changes);
+			if (res < 0) {
+				ULOG_ERRNO("", -res);
+				return res;
+			}
+		}
 #else
 		struct h265_vps *vps = ctx->vps;
 		ULOG_ERRNO_RETURN_ERR_IF(vps == NULL, EIO);
-#endif
+
 		H265_BEGIN_STRUCT(vps);
-		res = H265_SYNTAX_FCT(vps)(bs, vps);
+		res = H265_END(bs, H265_SYNTAX_FCT(vps)(bs, vps));
 		H265_END_STRUCT(vps);
 
 		if (res < 0) {
 			ULOG_ERRNO("", -res);
-#if H265_SYNTAX_OP_KIND == H265_SYNTAX_OP_KIND_READ
-			free(vps);
-#endif
-			return res;
-		}
-
-#if H265_SYNTAX_OP_KIND == H265_SYNTAX_OP_KIND_READ
-		res = h265_ctx_set_vps(ctx, vps);
-		if (res < 0) {
-			ULOG_ERRNO("", -res);
-			free(vps);
 			return res;
 		}
-		free(vps);
 #endif
 		H265_CB(ctx, cbs, userdata, vps, buf, len, ctx->vps);
+#if H265_SYNTAX_OP_KIND == H265_SYNTAX_OP_KIND_READ
+		h265_ctx_ps_changed(
+			ctx, cbs, userdata, header->nal_unit_type, changes);
+#endif
 		break;
 	}
 
 	case H265_NALU_TYPE_SPS_NUT: {
 #if H265_SYNTAX_OP_KIND == H265_SYNTAX_OP_KIND_READ
-		struct h265_sps *sps = calloc(1, sizeof(*sps));
-		ULOG_ERRNO_RETURN_ERR_IF(sps == NULL, ENOMEM);
+		/* Repeated SPS: reuse the stored one, see h265_ctx_reuse_ps() */
+		if (!h265_ctx_reuse_ps(ctx,
+				       header->nal_unit_type,
+				       buf,
+				       len,
+				       H265_READ_FLAGS())) {
+			res = h265_ctx_set_ps_from_nalu(ctx,
+							bs,
+							header->nal_unit_type,
+							buf,
+							len,
+							H265_READ_FLAGS(),
+							&changes);
+			if (res < 0) {
+				ULOG_ERRNO("", -res);
+				return res;
+			}
+		}
 #else
 		struct h265_sps *sps = ctx->sps;
 		ULOG_ERRNO_RETURN_ERR_IF(sps == NULL, EIO);
-#endif
 
 		H265_BEGIN_STRUCT(sps);
-		res = H265_SYNTAX_FCT(sps)(bs, sps);
+		res = H265_END(bs, H265_SYNTAX_FCT(sps)(bs, sps));
 		H265_END_STRUCT(sps);
 
 		if (res < 0) {
 			ULOG_ERRNO("", -res);
-#if H265_SYNTAX_OP_KIND == H265_SYNTAX_OP_KIND_READ
-			free(sps);
-#endif
 			return res;
 		}
-
-#if H265_SYNTAX_OP_KIND == H265_SYNTAX_OP_KIND_READ
-		res = h265_ctx_set_sps(ctx, sps);
-		if (res < 0) {
-			ULOG_ERRNO("", -res);
-			free(sps);
-			return res;
-		}
-		free(sps);
 #endif
 		H265_CB(ctx, cbs, userdata, sps, buf, len, ctx->sps);
+#if H265_SYNTAX_OP_KIND == H265_SYNTAX_OP_KIND_READ
+		h265_ctx_ps_changed(
+			ctx, cbs, userdata, header->nal_unit_type, changes);
+#endif
 		break;
 	}
 
 	case H265_NALU_TYPE_PPS_NUT: {
 #if H265_SYNTAX_OP_KIND == H265_SYNTAX_OP_KIND_READ
-		struct h265_pps *pps = calloc(1, sizeof(*pps));
-		ULOG_ERRNO_RETURN_ERR_IF(pps == NULL, ENOMEM);
+		/* Repeated PPS: reuse the stored one, see h265_ctx_reuse_ps() */
+		if (!h265_ctx_reuse_ps(ctx,
+				       header->nal_unit_type,
+				       buf,
+				       len,
+				       H265_READ_FLAGS())) {
+			res = h265_ctx_set_ps_from_nalu(ctx,
+							bs,
+							header->nal_unit_type,
+							buf,
+							len,
+							H265_READ_FLAGS(),
+							&changes);
+			if (res < 0) {
+				ULOG_ERRNO("", -res);
+				return res;
+			}
+		}
 #else
 		struct h265_pps *pps = ctx->pps;
 		ULOG_ERRNO_RETURN_ERR_IF(pps == NULL, EIO);
-#endif
+
 		H265_BEGIN_STRUCT(pps);
-		res = H265_SYNTAX_FCT(pps)(bs, pps);
+		res = H265_END(bs, H265_SYNTAX_FCT(pps)(bs, pps));
 		H265_END_STRUCT(pps);
 
 		if (res < 0) {
 			ULOG_ERRNO("", -res);
-#if H265_SYNTAX_OP_KIND == H265_SYNTAX_OP_KIND_READ
-			h265_pps_clear(pps);
-			free(pps);
-#endif
-			return res;
-		}
-
-#if H265_SYNTAX_OP_KIND == H265_SYNTAX_OP_KIND_READ
-		res = h265_ctx_set_pps(ctx, pps);
-		if (res < 0) {
-			ULOG_ERRNO("", -res);
-			h265_pps_clear(pps);
-			free(pps);
 			return res;
 		}
-		h265_pps_clear(pps);
-		free(pps);
 #endif
 		H265_CB(ctx, cbs, userdata, pps, buf, len, ctx->pps);
+#if H265_SYNTAX_OP_KIND == H265_SYNTAX_OP_KIND_READ
+		h265_ctx_ps_changed(
+			ctx, cbs, userdata, header->nal_unit_type, changes);
+#endif
 		break;
 	}
 
 	case H265_NALU_TYPE_AUD_NUT: {
 		H265_BEGIN_STRUCT(aud);
-		res = H265_SYNTAX_FCT(aud)(bs, &ctx->aud);
+		res = H265_END(bs, H265_SYNTAX_FCT(aud)(bs, &ctx->aud));
 		H265_END_STRUCT(aud);
 		ULOG_ERRNO_RETURN_ERR_IF(res < 0, -res);
 		H265_CB(ctx, cbs, userdata, aud, buf, len, &ctx->aud);
@@ -1983,6 +2746,74 @@ static int H265_SYNTAX_FCT(nalu)(struct h265_bitstream *bs,
 		break;
 	}
 
+	case H265_NALU_TYPE_TRAIL_N:
+	case H265_NALU_TYPE_TRAIL_R:
+	case H265_NALU_TYPE_TSA_N:
+	case H265_NALU_TYPE_TSA_R:
+	case H265_NALU_TYPE_STSA_N:
+	case H265_NALU_TYPE_STSA_R:
+	case H265_NALU_TYPE_RADL_N:
+	case H265_NALU_TYPE_RADL_R:
+	case H265_NALU_TYPE_RASL_N:
+	case H265_NALU_TYPE_RASL_R:
+	case H265_NALU_TYPE_BLA_W_LP:
+	case H265_NALU_TYPE_BLA_W_RADL:
+	case H265_NALU_TYPE_BLA_N_LP:
+	case H265_NALU_TYPE_IDR_W_RADL:
+	case H265_NALU_TYPE_IDR_N_LP:
+	case H265_NALU_TYPE_CRA_NUT: {
+		size_t slice_data_offset = 0;
+
+		/* The slice segment headers of the other layers depend on the
+		 * VPS extension, which is not supported */
+		if (header->nuh_layer_id != 0) {
+			ctx->nalu_unknown = 1;
+			break;
+		}
+
+		H265_BEGIN_STRUCT(slice_header);
+		res = H265_END(bs,
+			       H265_SYNTAX_FCT(slice_header)(
+				       bs, ctx, header, &ctx->slice_header));
+		H265_END_STRUCT(slice_header);
+
+#if H265_SYNTAX_OP_KIND != H265_SYNTAX_OP_KIND_WRITE
+		/* Parameter sets not received yet (e.g. when starting in the
+		 * middle of a stream), or invalid slice segment header: the
+		 * access unit detection only needs its first bit */
+		if (res < 0) {
+			if (res != -ENOENT)
+				ULOG_ERRNO("slice_header", -res);
+			ctx->nalu_unknown = 1;
+			break;
+		}
+#else
+		ULOG_ERRNO_RETURN_ERR_IF(res < 0, -res);
+#endif
+
+#if H265_SYNTAX_OP_KIND == H265_SYNTAX_OP_KIND_READ
+		/* The parameter sets referred to become the current ones */
+		uint32_t pps_id = ctx->slice_header.slice_pic_parameter_set_id;
+		ctx->pps = ctx->pps_table[pps_id];
+		ctx->sps = ctx->sps_table[ctx->pps->pps_seq_parameter_set_id];
+		uint32_t vps_id = ctx->sps->sps_video_parameter_set_id;
+		if (ctx->vps_table[vps_id] != NULL)
+			ctx->vps = ctx->vps_table[vps_id];
+
+		slice_data_offset = h265_bs_read_off(bs);
+		sh = &ctx->slice_header;
+#endif
+		H265_CB(ctx,
+			cbs,
+			userdata,
+			slice_header,
+			buf,
+			len,
+			&ctx->slice_header,
+			slice_data_offset);
+		break;
+	}
+
 	default:
 		ctx->nalu_unknown = 1;
 		/* TODO */
@@ -1990,6 +2821,9 @@ static int H265_SYNTAX_FCT(nalu)(struct h265_bitstream *bs,
 	}
 
 #if H265_SYNTAX_OP_KIND == H265_SYNTAX_OP_KIND_READ
+	/* clang-format off */
+nalu_end:
+	/* clang-format on */
 	/* AU change detection */
 	if (ctx->first_vcl_of_current_frame_found &&
 	    can_start_au(header, buf, len)) {
@@ -1998,6 +2832,8 @@ static int H265_SYNTAX_FCT(nalu)(struct h265_bitstream *bs,
 	}
 	if (is_first_vcl(header, buf, len))
 		ctx->first_vcl_of_current_frame_found = 1;
+	h265_ctx_update_au_info(
+		ctx, cbs, userdata, is_first_vcl(header, buf, len), sh);
 #endif
 
 	H265_CB(ctx,
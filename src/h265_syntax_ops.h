@@ -61,6 +61,10 @@
 #	error "H265_BITS_RBSP_TRAILING shall be defined first"
 #endif
 
+#ifndef H265_BYTES
+#	error "H265_BYTES shall be defined first"
+#endif
+
 #if H265_SYNTAX_OP_KIND == H265_SYNTAX_OP_KIND_READ
 #	define H265_SYNTAX_CONST
 #else
@@ -90,7 +94,43 @@
 #define H265_READ_BITS_UE(_f) _H265_READ_BITS(ue, uint32_t, _f)
 #define H265_READ_BITS_SE(_f) _H265_READ_BITS(se, int32_t, _f)
 
-#define H265_READ_FLAGS() (((struct h265_reader *)(bs->priv))->flags)
+/* Unchecked reads: fields are read without checking for the end of stream,
+ * H265_READ_END() shall be used once the structure is parsed */
+#define H265_READ_BITS_UNCHECKED(_f, _n)                                       \
+	((_f) = h265_bs_read_bits_u_unchecked(bs, (_n)))
+#define H265_READ_BITS_U_UNCHECKED(_f, _n)                                     \
+	((_f) = h265_bs_read_bits_u_unchecked(bs, (_n)))
+#define H265_READ_BITS_I_UNCHECKED(_f, _n)                                     \
+	((_f) = h265_bs_read_bits_i_unchecked(bs, (_n)))
+#define H265_READ_BITS_UE_UNCHECKED(_f)                                        \
+	((_f) = h265_bs_read_bits_ue_unchecked(bs))
+#define H265_READ_BITS_SE_UNCHECKED(_f)                                        \
+	((_f) = h265_bs_read_bits_se_unchecked(bs))
+
+#define H265_READ_END(_bs, _res) h265_bs_read_end((_bs), (_res))
+
+#define H265_READ_BYTES(_f, _n)                                                \
+	do {                                                                   \
+		int _res = h265_bs_read_bytes(bs, (_f), (_n));                 \
+		ULOG_ERRNO_RETURN_ERR_IF(_res < 0, -_res);                     \
+	} while (0)
+
+/* Reader flags, none when parsing outside of a reader */
+#define H265_READ_FLAGS()                                                      \
+	((bs->priv != NULL) ? ((struct h265_reader *)(bs->priv))->flags : 0)
+
+/* NAL unit as given to the reader (bitstream data may be its RBSP) */
+#define H265_READ_NALU_BUF() (((struct h265_reader *)(bs->priv))->nalu_buf)
+#define H265_READ_NALU_LEN() (((struct h265_reader *)(bs->priv))->nalu_len)
+
+/* Range of the bitstream data in the NAL unit given to the reader, NULL if
+ * it contains emulation prevention bytes, see h265_reader_nalu_view() */
+#define H265_READ_NALU_VIEW(_p, _len)                                          \
+	((bs->priv != NULL) ? h265_reader_nalu_view(                           \
+				      (struct h265_reader *)(bs->priv),        \
+				      (_p),                                    \
+				      (_len))                                  \
+			    : NULL)
 
 
 #define _H265_WRITE_BITS(_name, _type, _field, ...)                            \
@@ -106,6 +146,12 @@
 #define H265_WRITE_BITS_UE(_f) _H265_WRITE_BITS(ue, uint32_t, _f)
 #define H265_WRITE_BITS_SE(_f) _H265_WRITE_BITS(se, int32_t, _f)
 
+#define H265_WRITE_BYTES(_f, _n)                                               \
+	do {                                                                   \
+		int _res = h265_bs_write_bytes(bs, (_f), (_n));                \
+		ULOG_ERRNO_RETURN_ERR_IF(_res < 0, -_res);                     \
+	} while (0)
+
 
 #define _H265_DUMP_CALL(_fct, ...)                                             \
 	do {                                                                   \
@@ -120,9 +166,24 @@
 #define H265_DUMP_BITS_UE(_f) _H265_DUMP_CALL(field, #_f, _f)
 #define H265_DUMP_BITS_SE(_f) _H265_DUMP_CALL(field, #_f, _f)
 
+/* Bytes are dumped as fields (in an array) */
+#define H265_DUMP_BYTES(_f, _n)                                                \
+	do {                                                                   \
+		for (size_t _i = 0; _i < (size_t)(_n); _i++)                  \
+			_H265_DUMP_CALL(field, #_f, (_f)[_i]);                 \
+	} while (0)
+
 #define H265_DUMP_FLAGS() (((struct h265_dump *)(bs->priv))->flags)
 
 
+/* Result of the processing of a structure (see H265_READ_END()) */
+#if H265_SYNTAX_OP_KIND == H265_SYNTAX_OP_KIND_READ
+#	define H265_END(_bs, _res) H265_READ_END(_bs, _res)
+#else
+#	define H265_END(_bs, _res) (_res)
+#endif
+
+
 /* clang-format off */
 #if H265_SYNTAX_OP_KIND == H265_SYNTAX_OP_KIND_DUMP
 #  define H265_BEGIN_STRUCT(_name)   _H265_DUMP_CALL(begin_struct, #_name)
@@ -157,6 +218,7 @@
 #define H265_SEI(_name)                                                        \
 	do {                                                                   \
 		int _res = H265_SYNTAX_FCT(sei_##_name)(bs, ctx, &sei->_name); \
+		_res = H265_END(bs, _res);                                     \
 		ULOG_ERRNO_RETURN_ERR_IF(_res < 0, -_res);                     \
 		H265_CB(ctx,                                                   \
 			cbs,                                                   \
@@ -305,6 +305,38 @@ const char *h265_sei_type_str(enum h265_sei_type val)
 }
 
 
+const char *h265_slice_type_str(enum h265_slice_type val)
+{
+	switch (val) {
+	case H265_SLICE_TYPE_B:
+		return "B";
+	case H265_SLICE_TYPE_P:
+		return "P";
+	case H265_SLICE_TYPE_I:
+		return "I";
+	default:
+		return "UNKNOWN";
+	}
+}
+
+
+const char *h265_pic_class_str(enum h265_pic_class val)
+{
+	switch (val) {
+	case H265_PIC_CLASS_TRAILING:
+		return "TRAILING";
+	case H265_PIC_CLASS_RADL:
+		return "RADL";
+	case H265_PIC_CLASS_RASL:
+		return "RASL";
+	case H265_PIC_CLASS_IRAP:
+		return "IRAP";
+	default:
+		return "UNKNOWN";
+	}
+}
+
+
 int h265_sei_update_internal_buf(struct h265_sei *sei)
 {
 	uint32_t start = 0;
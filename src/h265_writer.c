@@ -35,6 +35,7 @@
 #define H265_BITS_I(_f, _n) H265_WRITE_BITS_I(_f, _n)
 #define H265_BITS_UE(_f) H265_WRITE_BITS_UE(_f)
 #define H265_BITS_SE(_f) H265_WRITE_BITS_SE(_f)
+#define H265_BYTES(_f, _n) H265_WRITE_BYTES(_f, _n)
 
 #define H265_BITS_RBSP_TRAILING()                                              \
 	do {                                                                   \
@@ -47,7 +48,25 @@
 
 int h265_write_nalu(struct h265_bitstream *bs, struct h265_ctx *ctx)
 {
-	return _h265_write_nalu(bs, ctx, NULL, NULL);
+	int res = 0;
+	struct h265_bitstream rbsp;
+
+	ULOG_ERRNO_RETURN_ERR_IF(bs == NULL, EINVAL);
+
+	if (!bs->emulation_prevention || !h265_bs_byte_aligned(bs))
+		return _h265_write_nalu(bs, ctx, NULL, NULL);
+
+	/* Write the RBSP first, then insert the emulation prevention bytes
+	 * in a single pass */
+	h265_bs_init(&rbsp, NULL, 0, 0);
+	res = _h265_write_nalu(&rbsp, ctx, NULL, NULL);
+	if (res < 0)
+		goto out;
+	res = h265_bs_write_escaped(bs, rbsp.data, rbsp.off);
+
+out:
+	h265_bs_clear(&rbsp);
+	return res;
 }
 
 
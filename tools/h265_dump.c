@@ -242,9 +242,12 @@ static void nalu_end_cb(struct h265_ctx *ctx,
 		} else if (bs.off == len) {
 			ok = (memcmp(bs.data, buf, len) == 0);
 		} else if (bs.off < len) {
-			/* trailing_zero_8bits */
+			/* trailing_zero_8bits; for a slice segment, only the
+			 * header is written and the slice data follows */
 			ok = (memcmp(bs.data, buf, bs.off) == 0);
-			for (uint32_t i = bs.off; ok && i < len; i++)
+			for (uint32_t i = bs.off;
+			     ok && type >= H265_NALU_TYPE_VPS_NUT && i < len;
+			     i++)
 				ok = (buf[i] == 0x00);
 
 		} else {
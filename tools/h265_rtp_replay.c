@@ -0,0 +1,538 @@
+/**
+ * Copyright (c) 2019 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Drones SAS Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT DRONES SAS COMPANY BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * RTP depacketizer replay tool: the RTP packets of a replay file are given
+ * to h265_rtp_depay_process() and the NAL units and access unit ends output
+ * by the depacketizer are checked against the ones expected by the file.
+ *
+ * Replay file format, one command or expected event per line ('#' starts a
+ * comment line):
+ *   session <max_don_diff>  Start a new depacketizer session (a session
+ *                           with max_don_diff 0 is started implicitly)
+ *   packet <hex>            RTP packet (RFC 3550 header included)
+ *   flush                   Call h265_rtp_depay_flush()
+ *   stats packets=<n> lost=<n> dropped=<n> nalus=<n> dropped_nalus=<n>
+ *         aus=<n> incomplete_aus=<n>  (on a single line)
+ *                           Expected statistics of the session
+ * Expected events, following the command producing them:
+ *   nalu <timestamp> <don|-> <hex>
+ *   au <timestamp> complete|incomplete
+ *   invalid                 The packet was rejected (-EPROTO)
+ *
+ * The commands and the events actually output are written in the same
+ * format, so that the output of a replay file without expected events can
+ * be reviewed and used as a new replay file. See h265_rtp_replay_sample.txt
+ * for the single NAL unit, AP and FU cases, with and without DONL fields,
+ * packet loss and sequence restart.
+ */
+
+#include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ULOG_TAG h265_rtp_replay
+#include <ulog.h>
+ULOG_DECLARE_TAG(h265_rtp_replay);
+
+#include <h265/h265.h>
+
+
+/* Maximum length of a replay file line */
+#define LINE_MAX_LEN 8192
+
+/* Maximum number of events output by a single command */
+#define EVENTS_MAX 256
+
+
+struct app {
+	const char *inpath;
+	const char *outpath;
+	FILE *fin;
+	FILE *fout;
+	int check;
+	struct h265_rtp_depay *depay;
+	uint32_t max_don_diff;
+	unsigned int line;
+	unsigned int errors;
+
+	/* Events output by the last command; the ones before event_idx
+	 * have been matched with the expected events */
+	char *events[EVENTS_MAX];
+	unsigned int event_count;
+	unsigned int event_idx;
+};
+
+
+static void mismatch(struct app *app, const char *expected, const char *got)
+{
+	ULOGE("%s:%u: expected '%s', got '%s'",
+	      app->inpath,
+	      app->line,
+	      expected,
+	      got);
+	app->errors++;
+}
+
+
+static void add_event(struct app *app, char *event)
+{
+	if (event == NULL) {
+		ULOG_ERRNO("malloc", ENOMEM);
+		app->errors++;
+		return;
+	}
+
+	fprintf(app->fout, "%s\n", event);
+	if (app->event_count == EVENTS_MAX) {
+		ULOGE("%s:%u: too many events", app->inpath, app->line);
+		app->errors++;
+		free(event);
+		return;
+	}
+	app->events[app->event_count++] = event;
+}
+
+
+/* Check that all the events output by the last command were expected */
+static void clear_events(struct app *app)
+{
+	for (unsigned int i = 0; i < app->event_count; i++) {
+		if (app->check && i >= app->event_idx)
+			mismatch(app, "", app->events[i]);
+		free(app->events[i]);
+	}
+	app->event_count = 0;
+	app->event_idx = 0;
+}
+
+
+static void check_event(struct app *app, const char *expected)
+{
+	if (!app->check)
+		return;
+
+	if (app->event_idx == app->event_count) {
+		mismatch(app, expected, "");
+		return;
+	}
+	if (strcmp(expected, app->events[app->event_idx]) != 0)
+		mismatch(app, expected, app->events[app->event_idx]);
+	app->event_idx++;
+}
+
+
+static void nalu_cb(struct h265_rtp_depay *depay,
+		    const uint8_t *buf,
+		    size_t len,
+		    const struct h265_rtp_nalu_info *info,
+		    void *userdata)
+{
+	struct app *app = userdata;
+	size_t size = 2 * len + 32;
+	char *event = malloc(size);
+	int n;
+
+	if (event != NULL) {
+		if (app->max_don_diff > 0) {
+			n = snprintf(event,
+				     size,
+				     "nalu %" PRIu32 " %u ",
+				     info->timestamp,
+				     info->don);
+		} else {
+			n = snprintf(event,
+				     size,
+				     "nalu %" PRIu32 " - ",
+				     info->timestamp);
+		}
+		for (size_t i = 0; i < len; i++)
+			n += snprintf(event + n, size - n, "%02x", buf[i]);
+	}
+	add_event(app, event);
+}
+
+
+static void au_end_cb(struct h265_rtp_depay *depay,
+		      uint32_t timestamp,
+		      int complete,
+		      void *userdata)
+{
+	struct app *app = userdata;
+	size_t size = 32;
+	char *event = malloc(size);
+
+	if (event != NULL) {
+		snprintf(event,
+			 size,
+			 "au %" PRIu32 " %s",
+			 timestamp,
+			 complete ? "complete" : "incomplete");
+	}
+	add_event(app, event);
+}
+
+
+static const struct h265_rtp_depay_cbs cbs = {
+	.nalu = &nalu_cb,
+	.au_end = &au_end_cb,
+};
+
+
+static int session_start(struct app *app, uint32_t max_don_diff)
+{
+	int res;
+	struct h265_rtp_depay_cfg cfg = {
+		.max_don_diff = max_don_diff,
+	};
+
+	if (app->depay != NULL) {
+		res = h265_rtp_depay_destroy(app->depay);
+		if (res < 0)
+			ULOG_ERRNO("h265_rtp_depay_destroy", -res);
+		app->depay = NULL;
+	}
+
+	app->max_don_diff = max_don_diff;
+	res = h265_rtp_depay_new(&cfg, &cbs, app, &app->depay);
+	if (res < 0)
+		ULOG_ERRNO("h265_rtp_depay_new", -res);
+	return res;
+}
+
+
+static int parse_hex(const char *str, uint8_t **ret_buf, size_t *ret_len)
+{
+	size_t len = strlen(str);
+	uint8_t *buf;
+	unsigned int v;
+
+	if (len == 0 || len % 2 != 0)
+		return -EINVAL;
+	buf = malloc(len / 2);
+	if (buf == NULL)
+		return -ENOMEM;
+	for (size_t i = 0; i < len / 2; i++) {
+		if (sscanf(str + 2 * i, "%2x", &v) != 1) {
+			free(buf);
+			return -EINVAL;
+		}
+		buf[i] = v;
+	}
+
+	*ret_buf = buf;
+	*ret_len = len / 2;
+	return 0;
+}
+
+
+static int cmd_packet(struct app *app, const char *arg)
+{
+	int res;
+	uint8_t *buf = NULL;
+	size_t len = 0;
+	char *event;
+
+	res = parse_hex(arg, &buf, &len);
+	if (res < 0) {
+		ULOGE("%s:%u: invalid packet", app->inpath, app->line);
+		return res;
+	}
+
+	res = h265_rtp_depay_process(app->depay, buf, len);
+	free(buf);
+	if (res == -EPROTO) {
+		/* Invalid packets are part of the replay */
+		event = strdup("invalid");
+		add_event(app, event);
+		res = 0;
+	} else if (res < 0) {
+		ULOG_ERRNO("h265_rtp_depay_process", -res);
+	}
+
+	return res;
+}
+
+
+static int cmd_stats(struct app *app, const char *expected)
+{
+	int res;
+	struct h265_rtp_depay_stats stats;
+	char str[256];
+
+	res = h265_rtp_depay_get_stats(app->depay, &stats);
+	if (res < 0) {
+		ULOG_ERRNO("h265_rtp_depay_get_stats", -res);
+		return res;
+	}
+
+	snprintf(str,
+		 sizeof(str),
+		 "stats packets=%" PRIu64 " lost=%" PRIu64
+		 " dropped=%" PRIu64 " nalus=%" PRIu64
+		 " dropped_nalus=%" PRIu64 " aus=%" PRIu64
+		 " incomplete_aus=%" PRIu64,
+		 stats.packets,
+		 stats.lost_packets,
+		 stats.dropped_packets,
+		 stats.nalus,
+		 stats.dropped_nalus,
+		 stats.aus,
+		 stats.incomplete_aus);
+	fprintf(app->fout, "%s\n", str);
+	if (app->check && strcmp(str, expected) != 0)
+		mismatch(app, expected, str);
+
+	return 0;
+}
+
+
+static int process_line(struct app *app, char *line)
+{
+	int res = 0;
+	size_t len = strlen(line);
+	char *sep;
+	char *arg;
+	char *end;
+	unsigned long v;
+
+	/* Trim the line and split the keyword from its argument */
+	while (len > 0 && strchr(" \t\r\n", line[len - 1]) != NULL)
+		line[--len] = '\0';
+	while (*line == ' ' || *line == '\t')
+		line++;
+	if (*line == '\0' || *line == '#')
+		return 0;
+	sep = line + strcspn(line, " \t");
+	arg = sep;
+	if (*sep != '\0') {
+		*sep = '\0';
+		arg = sep + 1 + strspn(sep + 1, " \t");
+	}
+
+	/* Expected events, compared as a whole line */
+	if (strcmp(line, "nalu") == 0 || strcmp(line, "au") == 0 ||
+	    strcmp(line, "invalid") == 0) {
+		if (*arg != '\0')
+			*sep = ' ';
+		check_event(app, line);
+		return 0;
+	}
+
+	/* Commands: the events of the previous command are all matched */
+	clear_events(app);
+	if (strcmp(line, "session") == 0) {
+		v = strtoul(arg, &end, 10);
+		if (*arg == '\0' || *end != '\0' || v > UINT32_MAX) {
+			ULOGE("%s:%u: invalid session", app->inpath, app->line);
+			return -EINVAL;
+		}
+		fprintf(app->fout, "session %lu\n", v);
+		return session_start(app, v);
+	}
+	if (app->depay == NULL) {
+		res = session_start(app, 0);
+		if (res < 0)
+			return res;
+	}
+	if (strcmp(line, "packet") == 0) {
+		fprintf(app->fout, "packet %s\n", arg);
+		res = cmd_packet(app, arg);
+	} else if (strcmp(line, "flush") == 0) {
+		fprintf(app->fout, "flush\n");
+		res = h265_rtp_depay_flush(app->depay);
+		if (res < 0)
+			ULOG_ERRNO("h265_rtp_depay_flush", -res);
+	} else if (strcmp(line, "stats") == 0) {
+		if (*arg != '\0')
+			*sep = ' ';
+		res = cmd_stats(app, line);
+	} else {
+		ULOGE("%s:%u: unknown command '%s'",
+		      app->inpath,
+		      app->line,
+		      line);
+		res = -EINVAL;
+	}
+
+	return res;
+}
+
+
+static const char short_options[] = "hno:";
+
+
+static const struct option long_options[] = {
+	{"help", no_argument, NULL, 'h'},
+	{"no-check", no_argument, NULL, 'n'},
+	{"output", required_argument, NULL, 'o'},
+	{0, 0, 0, 0},
+};
+
+
+static void welcome(char *prog_name)
+{
+	printf("\n%s - Parrot H.265 RTP depacketizer replay tool\n"
+	       "Copyright (c) 2019 Parrot Drones SAS\n\n",
+	       prog_name);
+}
+
+
+static void usage(char *prog_name)
+{
+	printf("Usage: %s [options] <replay file>\n"
+	       "\n"
+	       "Options:\n"
+	       "-h | --help                        Print this message\n"
+	       "-n | --no-check                    Do not check the "
+	       "expected events\n"
+	       "-o | --output <file>               Output file\n"
+	       "\n",
+	       prog_name);
+}
+
+
+int main(int argc, char *argv[])
+{
+	int res = 0;
+	int idx = 0;
+	int c = 0;
+	struct app app = {0};
+	char *line = NULL;
+
+	app.check = 1;
+
+	welcome(argv[0]);
+
+	if (argc < 2) {
+		usage(argv[0]);
+		exit(EXIT_FAILURE);
+	}
+
+	/* Command-line parameters */
+	while ((c = getopt_long(
+			argc, argv, short_options, long_options, &idx)) != -1) {
+		switch (c) {
+		case 0:
+			break;
+
+		case 'h':
+			usage(argv[0]);
+			exit(EXIT_SUCCESS);
+			break;
+
+		case 'n':
+			app.check = 0;
+			break;
+
+		case 'o':
+			app.outpath = optarg;
+			break;
+
+		default:
+			usage(argv[0]);
+			exit(EXIT_FAILURE);
+			break;
+		}
+	}
+	if (argc - optind < 1) {
+		usage(argv[0]);
+		exit(EXIT_FAILURE);
+	}
+
+	app.inpath = argv[optind];
+	if (app.inpath == NULL) {
+		fprintf(stderr, "Missing input path\n");
+		exit(EXIT_FAILURE);
+	}
+
+	/* Open the input file */
+	app.fin = fopen(app.inpath, "r");
+	if (app.fin == NULL) {
+		res = -errno;
+		ULOG_ERRNO("fopen('%s')", -res, app.inpath);
+		goto out;
+	}
+
+	/* Create output file */
+	if (app.outpath != NULL) {
+		app.fout = fopen(app.outpath, "w");
+		if (app.fout == NULL) {
+			res = -errno;
+			ULOG_ERRNO("fopen('%s')", -res, app.outpath);
+			goto out;
+		}
+	} else {
+		/* Use stdout by default */
+		app.fout = stdout;
+	}
+
+	line = malloc(LINE_MAX_LEN);
+	if (line == NULL) {
+		res = -ENOMEM;
+		ULOG_ERRNO("malloc", -res);
+		goto out;
+	}
+
+	/* Replay */
+	while (fgets(line, LINE_MAX_LEN, app.fin) != NULL) {
+		app.line++;
+		if (strchr(line, '\n') == NULL && !feof(app.fin)) {
+			res = -E2BIG;
+			ULOGE("%s:%u: line too long", app.inpath, app.line);
+			goto out;
+		}
+		res = process_line(&app, line);
+		if (res < 0)
+			goto out;
+	}
+	clear_events(&app);
+
+	if (app.errors > 0) {
+		ULOGE("%s: %u errors", app.inpath, app.errors);
+		res = -EPROTO;
+	}
+
+out:
+	/* Cleanup */
+	for (unsigned int i = 0; i < app.event_count; i++)
+		free(app.events[i]);
+	if (app.depay != NULL) {
+		int err = h265_rtp_depay_destroy(app.depay);
+		if (err < 0)
+			ULOG_ERRNO("h265_rtp_depay_destroy", -err);
+	}
+	free(line);
+	if (app.fout != NULL && app.fout != stdout)
+		fclose(app.fout);
+	if (app.fin != NULL)
+		fclose(app.fin);
+
+	return res >= 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}